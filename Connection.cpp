@@ -1,9 +1,10 @@
 #include <iostream>
 #include <algorithm>
+#include <cmath>
 #include "Connection.h"
 #include "Node.h"
 #include "constants.h"
-#include "log.h"
+#include "Trace.h"
 
 namespace asio = boost::asio;
 using udp = asio::ip::udp;
@@ -12,45 +13,251 @@ namespace pstime = boost::posix_time;
 using Error = boost::system::error_code;
 
 //------------------------------------------------------------------------------
-Connection::Connection(Node& node, Endpoint remote_endpoint)
+Connection::Connection(Node& node, ID remote_id, NeighborState::Slot slot)
   : _node(node)
-  , _remote_endpoint(remote_endpoint)
-  , _periodic_timer( node._ping_timeout
-                   , node.get_io_service(), [=]() { on_tick(); })
+  , _remote_id(remote_id)
+  , _slot(slot)
+  , _tick_timer(node.get_io_service(), [this]() { on_tick(); })
+  , _tick_duration(node._ping_timeout)
+  , _coalesce_timer(node.get_io_service(), [this]() { flush(); })
+  , _ack_timer(node.get_io_service(), [this]() { send_ack(); })
+  , _keepalive_timer(node.get_io_service(), [this]() { send_ack(); })
+  , _retransmit_timer(node.get_io_service(), [this]() { on_retransmit_timeout(); })
   , _missed_ping_count(0)
-  , _is_sending(false)
+  , _flush_scheduled(false)
   , _rx_sequence_id(0)
   , _tx_sequence_id(0)
-  , knows_my_result(false)
-  , is_contender(false)
+  , _tx_sent_id(0)
+  , _tx_acked_id(0)
+  , _has_rtt(false)
+  , _srtt(0)
+  , _rttvar(0)
+  , _backoff(0)
+  , _rx_held(0)
 {
   // The first message to establish connection.
   schedule_send<PingMsg>();
+
+  // The flush puts it on the wire, the tick counts missed pings.
+  _tick_timer.expires_from_now(_tick_duration);
+}
+
+//------------------------------------------------------------------------------
+// Datagrams are put together in a buffer shared by all connections of the
+// thread, the transport only borrows it while sending.
+static string& send_buffer() {
+  static thread_local string buffer;
+  buffer.clear();
+  return buffer;
 }
 
 //------------------------------------------------------------------------------
-void Connection::send(const Message& msg) {
-  if (_is_sending) return;
-  _is_sending = true;
+// Acks ride on data whenever some leaves within the delay, only otherwise
+// they go out in a frame of their own.
+void Connection::schedule_ack() {
+  if (_ack_timer.is_armed()) return;
+  _ack_timer.expires_from_now(pstime::milliseconds(ACK_DELAY_MS));
+}
+
+//------------------------------------------------------------------------------
+// The frame repeats the last of our messages the other side has, which
+// the original nodes take for a keep-alive just like their own pings.
+// A sequence number of 0 they would ignore and time us out on a quiet
+// link.
+void Connection::send_ack() {
+  PingMsg ack(_tx_acked_id, _rx_sequence_id);
+  ack.ack_bitmap = ack_bitmap();
 
-  stringstream ss;
-  ss << msg.label() << " " << msg;
+  auto& datagram = send_buffer();
+  encode_message(_node.wire_format(), ack, datagram);
+  send(datagram.data(), datagram.size());
+}
+
+//------------------------------------------------------------------------------
+void Connection::schedule_flush() {
+  if (_flush_scheduled) return;
+  _flush_scheduled = true;
 
   auto destroyed = _destroy_guard.indicator();
+  auto delay     = _node._coalesce_delay;
+
+  // Like Nagle's algorithm, only wait for more while something is
+  // already in flight: an idle link sends right away, so the delay
+  // isn't paid at every hop. Even then, everything scheduled by the
+  // current handler is sent together.
+  bool in_flight = !_tx_messages.empty() &&
+                   _tx_messages.front().message.sequence_number <= _tx_sent_id;
+
+  if (!in_flight || delay <= pstime::time_duration()) {
+    _node.get_io_service().post([this, destroyed]() {
+        if (destroyed) return;
+        flush();
+        });
+    return;
+  }
+
+  _coalesce_timer.expires_from_now(delay);
+}
+
+//------------------------------------------------------------------------------
+void Connection::flush() {
+  _flush_scheduled = false;
+
+  // Skip messages which are already on the wire, those are only
+  // retransmitted once their timeout passes.
+  size_t first = _tx_messages.size();
+
+  while (first > 0 &&
+         _tx_messages[first - 1].message.sequence_number > _tx_sent_id) {
+    --first;
+  }
+
+  send_messages(first);
+  arm_retransmit_timer();
+}
+
+//------------------------------------------------------------------------------
+// Sends the messages of the window from 'first' on which the other side
+// doesn't have yet. Those already on the wire only go again once their
+// retransmission timeout has passed. Returns how many did.
+size_t Connection::send_messages(size_t first) {
+  auto format = _node.wire_format();
+  auto time   = now();
+  auto rto    = retransmit_timeout();
+  size_t retransmits = 0;
+
+  // Text datagrams carry a single message so that nodes predating
+  // coalescing can still read them.
+  bool coalesce = format == WireFormat::binary;
+
+  auto bitmap = ack_bitmap();
+  auto last   = min(_tx_messages.size(), tx_window());
+
+  auto& datagram = send_buffer();
+
+  for (size_t i = first; i < last; ++i) {
+    // The other side already has it, it only waits for
+    // the messages before it.
+    if (_tx_messages[i].selectively_acked) continue;
+
+    auto& entry = _tx_messages[i];
+    auto& msg   = entry.message;
+
+    if (msg.sequence_number <= _tx_sent_id) {
+      if (time < entry.sent_at + rto) continue;
+      entry.retransmitted = true;
+      ++retransmits;
+      ++_counters.retransmits;
+    }
+
+    entry.sent_at           = time;
+    msg.ack_sequence_number = _rx_sequence_id;
+    msg.ack_bitmap          = bitmap;
+
+    size_t size_before = datagram.size();
+    encode_message(format, msg, datagram);
+    ++_counters.messages_out;
+
+    if (size_before != 0 &&
+        (!coalesce || datagram.size() > MAX_COALESCED_DATAGRAM_SIZE)) {
+      send(datagram.data(), size_before);
+      datagram.erase(0, size_before);
+    }
+
+    _tx_sent_id = max(_tx_sent_id, msg.sequence_number);
+  }
+
+  if (!datagram.empty()) send(datagram.data(), datagram.size());
+  return retransmits;
+}
+
+//------------------------------------------------------------------------------
+// Only what timed out goes again, every further timeout in a row
+// doubles the wait.
+void Connection::on_retransmit_timeout() {
+  if (send_messages(0) > 0) ++_backoff;
+  arm_retransmit_timer();
+}
+
+//------------------------------------------------------------------------------
+// Armed for whichever message in flight times out first.
+void Connection::arm_retransmit_timer() {
+  auto     last   = min(_tx_messages.size(), tx_window());
+  bool     any    = false;
+  uint64_t oldest = 0;
+
+  for (size_t i = 0; i < last; ++i) {
+    const auto& entry = _tx_messages[i];
+    if (entry.message.sequence_number > _tx_sent_id) break;
+    if (entry.selectively_acked) continue;
+    if (!any || entry.sent_at < oldest) oldest = entry.sent_at;
+    any = true;
+  }
+
+  if (!any) {
+    _retransmit_timer.cancel();
+    return;
+  }
+
+  auto time = now();
+  auto due  = oldest + retransmit_timeout();
+
+  _retransmit_timer.expires_from_now(pstime::milliseconds(due > time ? due - time : 0));
+}
+
+//------------------------------------------------------------------------------
+// Text is stop-and-wait: nodes predating the window take a message
+// ahead of the next one in order for a protocol error.
+size_t Connection::tx_window() const {
+  return _node.wire_format() == WireFormat::text ? 1 : WINDOW_SIZE;
+}
+
+//------------------------------------------------------------------------------
+uint64_t Connection::now() const {
+  return asio::use_service<TimerWheel>(_node.get_io_service()).tick_count();
+}
+
+//------------------------------------------------------------------------------
+void Connection::add_rtt_sample(uint64_t sent_at) {
+  double r = double(now() - sent_at);
+
+  if (!_has_rtt) {
+    _srtt    = r;
+    _rttvar  = r / 2;
+    _has_rtt = true;
+    return;
+  }
 
-  auto data = make_shared<string>(ss.str());
-  _node.socket().async_send_to
-    ( asio::buffer(*data)
-    , _remote_endpoint
-    , [this, data, destroyed](boost::system::error_code, size_t) {
-      if (destroyed) return;
-      _is_sending = false;
-    });
+  _rttvar = 0.75 * _rttvar + 0.25 * abs(_srtt - r);
+  _srtt   = 0.875 * _srtt + 0.125 * r;
 }
 
-void Connection::send_front_message() {
-  _tx_messages.front().ack_sequence_number = _rx_sequence_id;
-  send(_tx_messages.front());
+//------------------------------------------------------------------------------
+// Until a round trip was measured, a ping timeout.
+uint64_t Connection::retransmit_timeout() const {
+  uint64_t rto = _node._ping_timeout.total_milliseconds();
+
+  if (_has_rtt) {
+    rto = max<uint64_t>( MIN_RETRANSMIT_TIMEOUT_MS
+                       , uint64_t(ceil(_srtt + 4 * _rttvar)));
+  }
+
+  return rto << min(_backoff, MAX_RETRANSMIT_BACKOFF);
+}
+
+//------------------------------------------------------------------------------
+void Connection::send(const char* data, size_t size) {
+  // Whatever we send carries the latest acks and tells the other
+  // side we're alive, so pings are only needed on quiet links. They
+  // go out once per nominal tick, as the original nodes' did, and not
+  // per backed off one: the other side's ticks don't slow down with ours.
+  _ack_timer.cancel();
+  _keepalive_timer.expires_from_now(_node._ping_timeout);
+
+  ++_counters.datagrams_out;
+  _counters.bytes_out += size;
+
+  _node.transport().send(_remote_id, data, size);
 }
 
 //------------------------------------------------------------------------------
@@ -60,7 +267,7 @@ void Connection::on_tick() {
   if (_missed_ping_count > _node._max_missed_ping_count) {
     // Disonnection will destroy this object, so make sure you
     // return immediately.
-    _node.connection_lost(_remote_endpoint);
+    _node.connection_lost(_remote_id);
     return;
   }
 
@@ -68,12 +275,7 @@ void Connection::on_tick() {
     increment_timer_duration();
   }
 
-  if (!_tx_messages.empty()) {
-    send_front_message();
-  }
-  else {
-    send(PingMsg(_tx_sequence_id, _rx_sequence_id));
-  }
+  _tick_timer.expires_from_now(_tick_duration);
 }
 
 //------------------------------------------------------------------------------
@@ -87,28 +289,110 @@ void Connection::use_message(const StartMsg&) {
 
 //------------------------------------------------------------------------------
 void Connection::use_message(const NumberMsg& msg) {
-  random_number.reset(msg.random_number);
+  _node._neighbors.set_number(_slot, msg.random_number);
   _node.on_receive_number();
 }
 
 //------------------------------------------------------------------------------
 void Connection::use_message(const Update1Msg& msg) {
-  update1 = msg.status;
+  _node._neighbors.set_update1(_slot, msg.status);
   _node.on_receive_update1();
 }
 
 //------------------------------------------------------------------------------
 void Connection::use_message(const Update2Msg& msg) {
-  update2 = msg.status;
+  _node._neighbors.set_update2(_slot, msg.status);
   _node.on_receive_update2();
 }
 
 //------------------------------------------------------------------------------
 void Connection::use_message(const ResultMsg& msg) {
-  result = msg.status;
+  _node._neighbors.set_result(_slot, msg.status);
   _node.on_receive_result();
 }
 
+//------------------------------------------------------------------------------
+void Connection::use_message(const RepairMsg&) {
+  _node.on_receive_repair(_slot);
+}
+
+//------------------------------------------------------------------------------
+void Connection::use_message(const Message& msg) {
+  switch (msg.type) {
+    case MessageType::ping:    use_message(PingMsg(msg));    break;
+    case MessageType::start:   use_message(StartMsg(msg));   break;
+    case MessageType::number:  use_message(NumberMsg(msg));  break;
+    case MessageType::update1: use_message(Update1Msg(msg)); break;
+    case MessageType::update2: use_message(Update2Msg(msg)); break;
+    case MessageType::result:  use_message(ResultMsg(msg));  break;
+    case MessageType::repair:  use_message(RepairMsg(msg));  break;
+  }
+}
+
+//------------------------------------------------------------------------------
+void Connection::buffer_message(const Message& msg) {
+  // Further than the other side may send, something is wrong with it.
+  if (msg.sequence_number > _rx_sequence_id + WINDOW_SIZE) return;
+
+  if (!_rx_buffer) _rx_buffer.reset(new RxBuffer);
+
+  auto slot = msg.sequence_number % WINDOW_SIZE;
+  auto bit  = uint32_t(1) << slot;
+
+  if (!(_rx_held & bit)) {
+    (*_rx_buffer)[slot] = msg;
+    _rx_held |= bit;
+  }
+  else if ((*_rx_buffer)[slot].sequence_number == msg.sequence_number) {
+    ++_counters.duplicates;
+  }
+}
+
+//------------------------------------------------------------------------------
+void Connection::use_buffered_messages() {
+  auto destroyed = _destroy_guard.indicator();
+
+  while (_rx_held) {
+    auto slot = (_rx_sequence_id + 1) % WINDOW_SIZE;
+    auto bit  = uint32_t(1) << slot;
+
+    if (!(_rx_held & bit)) return;
+
+    // Copied out, the handler may buffer more messages.
+    Message msg = (*_rx_buffer)[slot];
+    if (msg.sequence_number != _rx_sequence_id + 1) return;
+
+    _rx_held &= ~bit;
+
+    TRACE(debug, TraceEvent::receive, node_id(), id(), msg.sequence_number
+         , uint16_t(msg.type));
+
+    _rx_sequence_id = msg.sequence_number;
+    use_message(msg);
+    if (destroyed) return;
+  }
+}
+
+//------------------------------------------------------------------------------
+// Bit i is set if we hold message _rx_sequence_id + 2 + i, so the other side
+// only needs to retransmit the ones we are missing.
+uint32_t Connection::ack_bitmap() const {
+  uint32_t bitmap = 0;
+  if (!_rx_held) return bitmap;
+
+  for (uint32_t i = 0; i < WINDOW_SIZE; ++i) {
+    uint32_t sequence_number = _rx_sequence_id + 2 + i;
+    uint32_t slot            = sequence_number % WINDOW_SIZE;
+
+    if ((_rx_held & (uint32_t(1) << slot)) &&
+        (*_rx_buffer)[slot].sequence_number == sequence_number) {
+      bitmap |= uint32_t(1) << i;
+    }
+  }
+
+  return bitmap;
+}
+
 //------------------------------------------------------------------------------
 void Connection::keep_alive() {
   _missed_ping_count = 0;
@@ -116,28 +400,83 @@ void Connection::keep_alive() {
 }
 
 //------------------------------------------------------------------------------
-void Connection::ack_message(uint32_t ack_sequence_number) {
+void Connection::ack_message(uint32_t ack_sequence_number, uint32_t bitmap) {
+  if (ack_sequence_number > _tx_acked_id && ack_sequence_number <= _tx_sent_id) {
+    _tx_acked_id = ack_sequence_number;
+  }
+
   if (_tx_messages.empty()) return;
 
-  if (_tx_messages.front().sequence_number == ack_sequence_number) {
+  bool was_full = _tx_messages.size() > tx_window();
+
+  // The round trip is sampled from the latest send acked by this, of
+  // messages sent only once. Karn's rule: a retransmitted one's ack
+  // may be for either send.
+  bool     progress       = false;
+  bool     has_sample     = false;
+  uint64_t sample_sent_at = 0;
+
+  auto acked = [&](const TxEntry& entry) {
+    progress = true;
+    if (entry.retransmitted || entry.message.sequence_number > _tx_sent_id) return;
+    if (has_sample && entry.sent_at <= sample_sent_at) return;
+    sample_sent_at = entry.sent_at;
+    has_sample     = true;
+  };
+
+  // The cumulative part.
+  while (!_tx_messages.empty() &&
+         _tx_messages.front().message.sequence_number <= ack_sequence_number) {
+    auto& entry = _tx_messages.front();
+    if (!entry.selectively_acked) acked(entry);
     _tx_messages.pop_front();
   }
+
+  // The selective part.
+  for (size_t j = 0; j < _tx_messages.size(); ++j) {
+    auto& entry = _tx_messages[j];
+    auto sequence_number = entry.message.sequence_number;
+    if (sequence_number <= ack_sequence_number + 1) continue;
+
+    uint32_t i = sequence_number - ack_sequence_number - 2;
+    if (i >= WINDOW_SIZE) break;
+
+    if ((bitmap & (uint32_t(1) << i)) && !entry.selectively_acked) {
+      entry.selectively_acked = true;
+      acked(entry);
+    }
+  }
+
+  // The backed off timeout stays until a sample shows the round trip
+  // is short again.
+  if (has_sample) {
+    add_rtt_sample(sample_sent_at);
+    _backoff = 0;
+  }
+
+  if (progress) arm_retransmit_timer();
+
+  // The window moved and there are messages which haven't been sent yet.
+  if (was_full && !_tx_messages.empty() &&
+      _tx_messages.back().message.sequence_number > _tx_sent_id) {
+    schedule_flush();
+  }
 }
 
 //------------------------------------------------------------------------------
 void Connection::increment_timer_duration() {
-  _periodic_timer.set_duration(_periodic_timer.duration()*2);
+  _tick_duration = _tick_duration * 2;
 }
 
 //------------------------------------------------------------------------------
 void Connection::decrement_timer_duration() {
   using namespace pstime;
-  auto default_d = milliseconds(PING_TIMEOUT_MS);
-  auto current_d = _periodic_timer.duration();
+  auto default_d = _node._ping_timeout;
+  auto current_d = _tick_duration;
 
   if (current_d > default_d) {
-    auto new_d = max<time_duration>(default_d, current_d - (default_d*0.5));
-    _periodic_timer.set_duration(new_d);
+    auto new_d = max<time_duration>(default_d, current_d - default_d / 2);
+    _tick_duration = new_d;
   }
 }
 
@@ -1,56 +1,97 @@
 #ifndef __CONNECTION_H__
 #define __CONNECTION_H__
 
+#include <array>
+#include <memory>
 #include <boost/asio.hpp>
-#include <boost/ptr_container/ptr_deque.hpp>
-#include <boost/optional.hpp>
 #include "Endpoint.h"
+#include "Counters.h"
 #include "DestroyGuard.h"
 #include "ID.h"
-#include "PeriodicTimer.h"
+#include "NeighborState.h"
+#include "RingBuffer.h"
+#include "TimerWheel.h"
+#include "constants.h"
+#include "Trace.h"
 #include "protocol.h"
 
 class Node;
 
 class Connection {
-  using MessagePtr = std::unique_ptr<Message>;
+  friend class Node;
 
 public:
-  Connection(Node&, Endpoint remote_endpoint);
+  Connection(Node&, ID remote_id, NeighborState::Slot);
 
   Connection(const Connection&)                  = delete;
   const Connection& operator=(const Connection&) = delete;
 
-  ID id() const { return ID(_remote_endpoint); }
+  ID id() const { return _remote_id; }
   ID node_id() const;
 
+  // Index of this connection's entry in the node's NeighborState.
+  NeighborState::Slot slot() const { return _slot; }
+
+  // Only the fields about traffic are used.
+  const Counters& counters() const { return _counters; }
+
+  // Heap memory of the send queue and the receive window, on top
+  // of sizeof(Connection). Bounded by the window for the receiving
+  // side, the send queue grows with whatever is scheduled faster
+  // than it is acknowledged.
+  size_t memory_usage() const {
+    return _tx_messages.memory_usage() + (_rx_buffer ? sizeof(RxBuffer) : 0);
+  }
+
+  // Messages are not put on the wire right away, everything scheduled
+  // until the coalescing delay expires leaves in as few datagrams as
+  // possible.
   template<class Msg, class... Args>
   void schedule_send(Args... args) {
-    bool was_empty = _tx_messages.empty();
-    Msg* msg = new Msg(++_tx_sequence_id, _rx_sequence_id, args...);
-    log(node_id(), " -> ", id(), " ", msg->label(), " ", *msg);
-    _tx_messages.push_back(msg);
-    if (was_empty) send_front_message();
+    Msg msg(++_tx_sequence_id, _rx_sequence_id, args...);
+    TRACE(debug, TraceEvent::send, node_id(), id(), msg.sequence_number
+         , uint16_t(msg.type));
+    _tx_messages.push_back(TxEntry{msg, false, false, 0});
+    schedule_flush();
   }
 
-  template<class Msg> void receive(const Msg& msg) {
-    assert(msg.sequence_number <= _rx_sequence_id + 1);
+  void receive(const Message& msg) {
+    ack_message(msg.ack_sequence_number, msg.ack_bitmap);
+    keep_alive();
+
+    auto sequence_number = msg.sequence_number;
 
-    ack_message(msg.ack_sequence_number);
+    // A ping we already have is an ack frame or the original nodes'
+    // keep-alive, only news need acknowledging. Answering those would
+    // have two nodes ack each other's acks forever.
+    if (sequence_number <= _rx_sequence_id && msg.type == MessageType::ping) {
+      return;
+    }
 
-    if (msg.sequence_number == _rx_sequence_id + 1) {
-      // DEBUG
-      if (msg.label() != "ping") {
-        log(node_id(), " <- ", id(), " ", msg.label(), " ", msg);
-      }
+    // Anything else needs an acknowledgement, even a duplicate
+    // as it means our previous one got lost.
+    schedule_ack();
 
-      keep_alive();
-      _rx_sequence_id = msg.sequence_number;
-      use_message(msg);
+    if (sequence_number <= _rx_sequence_id) {
+      ++_counters.duplicates;
+      return;
     }
-    else if (msg.sequence_number == _rx_sequence_id) {
-      keep_alive();
+
+    if (sequence_number != _rx_sequence_id + 1) {
+      buffer_message(msg);
+      return;
     }
+
+    TRACE(debug, TraceEvent::receive, node_id(), id(), sequence_number
+         , uint16_t(msg.type));
+
+    _rx_sequence_id = sequence_number;
+
+    auto destroyed = _destroy_guard.indicator();
+    use_message(msg);
+    if (destroyed) return;
+
+    use_buffered_messages();
   }
 
 private:
@@ -63,37 +104,81 @@ private:
   void use_message(const Update1Msg&);
   void use_message(const Update2Msg&);
   void use_message(const ResultMsg&);
+  void use_message(const RepairMsg&);
+  void use_message(const Message&);
 
-  void ack_message(uint32_t ack_sequence_number);
+  void buffer_message(const Message&);
+  void use_buffered_messages();
+  uint32_t ack_bitmap() const;
 
-  void send(const Message& msg);
-  void send_front_message();
+  void ack_message(uint32_t ack_sequence_number, uint32_t ack_bitmap);
 
-private:
-  Node&           _node;
-  const Endpoint  _remote_endpoint;
-  PeriodicTimer   _periodic_timer;
-  unsigned int    _missed_ping_count;
-  bool            _is_sending;
+  void schedule_ack();
+  void send_ack();
+
+  void schedule_flush();
+  void flush();
+  size_t send_messages(size_t first);
+  void send(const char* data, size_t size);
 
-  boost::ptr_deque<Message> _tx_messages;
+  void on_retransmit_timeout();
+  void arm_retransmit_timer();
+  void add_rtt_sample(uint64_t sent_at);
+  uint64_t retransmit_timeout() const; // In ticks
+  uint64_t now() const;                // Wheel ticks
+  size_t tx_window() const;            // Messages in flight at once
+
+private:
+  Node&                       _node;
+  const ID                    _remote_id;
+  NeighborState::Slot         _slot;
+  TimerWheel::Timer           _tick_timer;
+  TimerWheel::Duration        _tick_duration;
+  TimerWheel::Timer           _coalesce_timer;
+  TimerWheel::Timer           _ack_timer;
+  TimerWheel::Timer           _keepalive_timer;
+  TimerWheel::Timer           _retransmit_timer;
+  unsigned int                _missed_ping_count;
+  bool                        _flush_scheduled;
+  Counters                    _counters;
+
+  struct TxEntry {
+    Message  message;
+    bool     selectively_acked;
+    bool     retransmitted; // Its ack says nothing about the round trip
+    uint64_t sent_at;       // Wheel tick of the last send
+  };
+
+  // Messages waiting for acknowledgement, the first tx_window()
+  // of them may be in flight at once. A few fit inline, that is
+  // all a link usually has outstanding.
+  RingBuffer<TxEntry, 4>    _tx_messages;
   uint32_t                  _rx_sequence_id;
   uint32_t                  _tx_sequence_id;
+  uint32_t                  _tx_sent_id;  // Highest sequence number put on the wire
+  uint32_t                  _tx_acked_id; // Highest one the other side has in order
+
+  // Round trip estimate as in RFC 6298, in ticks, and how many times
+  // the retransmission timeout doubled since the last ack.
+  bool                      _has_rtt;
+  double                    _srtt;
+  double                    _rttvar;
+  unsigned int              _backoff;
+
+  // Messages received ahead of _rx_sequence_id + 1, indexed by
+  // sequence number modulo WINDOW_SIZE, with a bit of _rx_held set
+  // for each slot in use. Only allocated once something arrives
+  // out of order.
+  using RxBuffer = std::array<Message, WINDOW_SIZE>;
+
+  std::unique_ptr<RxBuffer> _rx_buffer;
+  uint32_t                  _rx_held;
 
   DestroyGuard              _destroy_guard;
 
   // Increment geometrically, decrement linearly.
   void increment_timer_duration();
   void decrement_timer_duration();
-
-public:
-  // FastMIS related data.
-  bool                          knows_my_result;
-  boost::optional<float>        random_number;
-  boost::optional<LeaderStatus> update1;
-  boost::optional<LeaderStatus> update2;
-  boost::optional<LeaderStatus> result;
-  bool                          is_contender;
 };
 
 #endif // ifndef __CONNECTION_H__
@@ -0,0 +1,53 @@
+#include <iostream>
+#include "Counters.h"
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+Counters& Counters::operator+=(const Counters& c) {
+  datagrams_in      += c.datagrams_in;
+  datagrams_out     += c.datagrams_out;
+  bytes_in          += c.bytes_in;
+  bytes_out         += c.bytes_out;
+  messages_out      += c.messages_out;
+  retransmits       += c.retransmits;
+  duplicates        += c.duplicates;
+  parse_failures    += c.parse_failures;
+  rounds            += c.rounds;
+  connection_losses += c.connection_losses;
+
+  for (size_t i = 0; i < PHASE_COUNT; ++i) {
+    time_in_phase[i] += c.time_in_phase[i];
+  }
+
+  return *this;
+}
+
+//------------------------------------------------------------------------------
+Counters operator+(Counters a, const Counters& b) {
+  return a += b;
+}
+
+//------------------------------------------------------------------------------
+std::ostream& operator<<(std::ostream& os, const Counters& c) {
+  using chrono::microseconds;
+  using chrono::duration_cast;
+
+  static const char* phase_names[] = { "idle", "numbers", "updates1", "updates2" };
+
+  os << "datagrams in/out: "  << c.datagrams_in << "/" << c.datagrams_out
+     << " bytes in/out: "     << c.bytes_in     << "/" << c.bytes_out
+     << " messages out: "     << c.messages_out
+     << " retransmits: "      << c.retransmits
+     << " duplicates: "       << c.duplicates
+     << " parse failures: "   << c.parse_failures
+     << " rounds: "           << c.rounds
+     << " connection losses: " << c.connection_losses;
+
+  for (size_t i = 0; i < Counters::PHASE_COUNT; ++i) {
+    os << " " << phase_names[i] << ": "
+       << duration_cast<microseconds>(c.time_in_phase[i]).count() << "us";
+  }
+
+  return os;
+}
@@ -0,0 +1,38 @@
+#ifndef __COUNTERS_H__
+#define __COUNTERS_H__
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+
+// Statistics a node and each of its connections keep all the time. They
+// are plain integers owned by the node's thread, take a snapshot with
+// Node::counters() from that thread (or once it stopped running).
+struct Counters {
+  // FastMIS states, same order as the node's state machine.
+  enum Phase { idle, numbers, updates1, updates2, PHASE_COUNT };
+
+  using Duration = std::chrono::steady_clock::duration;
+
+  uint64_t datagrams_in      = 0;
+  uint64_t datagrams_out     = 0;
+  uint64_t bytes_in          = 0;
+  uint64_t bytes_out         = 0;
+  uint64_t messages_out      = 0; // Retransmits included, ack frames not
+  uint64_t retransmits       = 0; // Messages sent again for lack of an ack
+  uint64_t duplicates        = 0; // Messages received again
+  uint64_t parse_failures    = 0; // Datagrams that couldn't be decoded
+  uint64_t rounds            = 0;
+  uint64_t connection_losses = 0;
+
+  std::array<Duration, PHASE_COUNT> time_in_phase = {{}};
+
+  Counters& operator+=(const Counters&);
+};
+
+Counters operator+(Counters, const Counters&);
+
+std::ostream& operator<<(std::ostream&, const Counters&);
+
+#endif // ifndef __COUNTERS_H__
@@ -1,49 +1,81 @@
 #ifndef __ID_H__
 #define __ID_H__
 
+#include <cstdint>
+#include <functional>
 #include <boost/asio/ip/udp.hpp>
 
 // TODO: I'm not sure how safe it is to use endpoint as an ID yet.
 //       Will have to think about it, but right now it's the easiest
 //       option. If its only to be run on a local network, then it
 //       should be safe (?).
+//
+// Nodes sharing one socket are told apart by a local id, which is zero
+// for a node that has the socket to itself.
 class ID {
   using UDP = boost::asio::ip::udp;
 
 public:
-  ID() {}
+  ID() : _local(0) {}
 
   // For testing only
   ID(unsigned short i) : ID(UDP::endpoint(UDP::v4(), i)) { }
 
-  ID(UDP::endpoint ep)
+  ID(UDP::endpoint ep, uint32_t local = 0)
+    : _local(local)
   {
     if (ep.address().is_unspecified()) {
       ep.address(boost::asio::ip::address_v4::loopback());
     }
-    endpoint = ep;
+    _endpoint = ep;
   }
 
+  const UDP::endpoint& endpoint() const { return _endpoint; }
+  uint32_t local() const { return _local; }
+
   bool operator<(const ID& id) const {
-    return endpoint < id.endpoint;
+    if (_endpoint != id._endpoint) return _endpoint < id._endpoint;
+    return _local < id._local;
   }
 
   bool operator==(const ID& id) const {
-    return endpoint == id.endpoint;
+    return _endpoint == id._endpoint && _local == id._local;
   }
 
   bool operator!=(const ID& id) const {
-    return endpoint != id.endpoint;
+    return !(*this == id);
   }
 
 private:
   friend std::ostream& operator<<(std::ostream&, const ID&);
 
-  boost::asio::ip::udp::endpoint endpoint;
+  boost::asio::ip::udp::endpoint _endpoint;
+  uint32_t                       _local;
 };
 
 inline std::ostream& operator<<(std::ostream& os, const ID& id) {
-  return os << id.endpoint.port();
+  os << id._endpoint.port();
+  if (id._local) os << "." << id._local;
+  return os;
+}
+
+namespace std {
+  template<> struct hash<ID> {
+    size_t operator()(const ID& id) const {
+      const auto& address = id.endpoint().address();
+
+      uint64_t h = address.is_v4() ? address.to_v4().to_uint() : 0;
+
+      if (address.is_v6()) {
+        for (auto byte : address.to_v6().to_bytes()) h = h * 131 + byte;
+      }
+
+      h = (h << 16 | id.endpoint().port()) * 0x9e3779b97f4a7c15ULL;
+      h ^= uint64_t(id.local()) * 0xc2b2ae3d27d4eb4fULL;
+
+      return h ^ (h >> 32);
+    }
+  };
 }
 
 #endif // ifndef __ID_H__
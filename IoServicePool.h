@@ -0,0 +1,66 @@
+#ifndef __IO_SERVICE_POOL_H__
+#define __IO_SERVICE_POOL_H__
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+// A set of io_services ("shards") each run by a thread of its own. Anything
+// created on a shard (nodes, their connections and timers) is only ever
+// touched by that shard's thread, so no locking is needed inside a node.
+class IoServicePool {
+  using IoService = boost::asio::io_service;
+
+public:
+  explicit IoServicePool(size_t shard_count) {
+    for (size_t i = 0; i < std::max<size_t>(shard_count, 1); ++i) {
+      _services.emplace_back(new IoService);
+    }
+  }
+
+  IoServicePool(const IoServicePool&)                  = delete;
+  const IoServicePool& operator=(const IoServicePool&) = delete;
+
+  size_t size() const { return _services.size(); }
+  IoService& operator[](size_t i) { return *_services[i]; }
+
+  // Runs every shard on its own thread, the first one on the calling
+  // thread, and returns once release() was called and all of them ran
+  // out of work.
+  void run() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      for (auto& s : _services) {
+        _work.emplace_back(new IoService::work(*s));
+      }
+    }
+
+    std::vector<std::thread> threads;
+
+    for (size_t i = 1; i < _services.size(); ++i) {
+      threads.emplace_back([this, i]() { _services[i]->run(); });
+    }
+
+    _services[0]->run();
+
+    for (auto& t : threads) t.join();
+
+    for (auto& s : _services) s->reset();
+  }
+
+  // Until this is called an idle shard keeps waiting, as another
+  // shard may still hand it some work. May be called from any thread.
+  void release() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _work.clear();
+  }
+
+private:
+  std::mutex                                    _mutex;
+  std::vector<std::unique_ptr<IoService>>       _services;
+  std::vector<std::unique_ptr<IoService::work>> _work;
+};
+
+#endif // ifndef __IO_SERVICE_POOL_H__
@@ -0,0 +1,150 @@
+#include "MemoryTransport.h"
+#include "Random.h"
+
+namespace asio = boost::asio;
+using namespace std;
+
+//------------------------------------------------------------------------------
+MemoryHub::MemoryHub()
+  : _next_address(0)
+  , _loss_probability(0)
+  , _duplicate_probability(0)
+  , _sent_count(0)
+  , _sent_bytes(0)
+  , _dropped_count(0)
+  , _duplicated_count(0)
+{}
+
+//------------------------------------------------------------------------------
+// Addresses only need to be unique and never run out, so they are
+// simply counted through the 10.0.0.0/8 block, one port per address.
+ID MemoryHub::attach(MemoryTransport& transport) {
+  // Port zero isn't a valid destination.
+  uint32_t n;
+  do { n = ++_next_address; } while ((n & 0xffff) == 0);
+
+  ID id(Endpoint(asio::ip::address_v4(0x0a000000 | (n >> 16)), n & 0xffff));
+
+  auto& shard = shard_of(id);
+  lock_guard<mutex> lock(shard.mutex);
+  shard.transports[id] = &transport;
+  return id;
+}
+
+//------------------------------------------------------------------------------
+void MemoryHub::detach(ID id) {
+  auto& shard = shard_of(id);
+  lock_guard<mutex> lock(shard.mutex);
+  shard.transports.erase(id);
+}
+
+//------------------------------------------------------------------------------
+// The copy into the destination's queue stands in for the kernel's
+// buffer. The shard stays locked meanwhile so that the destination
+// can't detach and go away under us.
+void MemoryHub::send(ID source, ID destination, const char* data, size_t size) {
+  _sent_count.fetch_add(1, memory_order_relaxed);
+  _sent_bytes.fetch_add(size, memory_order_relaxed);
+
+  auto& random = Random::instance();
+
+  if (_loss_probability > 0 && random.generate_float() < _loss_probability) {
+    _dropped_count.fetch_add(1, memory_order_relaxed);
+    return;
+  }
+
+  bool duplicate = _duplicate_probability > 0
+                && random.generate_float() < _duplicate_probability;
+
+  auto& shard = shard_of(destination);
+  lock_guard<mutex> lock(shard.mutex);
+
+  auto i = shard.transports.find(destination);
+  if (i == shard.transports.end()) return;
+
+  i->second->enqueue(source, data, size);
+
+  if (duplicate) {
+    _duplicated_count.fetch_add(1, memory_order_relaxed);
+    i->second->enqueue(source, data, size);
+  }
+}
+
+//------------------------------------------------------------------------------
+MemoryTransport::MemoryTransport(asio::io_service& ios, MemoryHub& hub)
+  : _io_service(ios)
+  , _hub(hub)
+  , _local_id(hub.attach(*this))
+  , _is_closed(false)
+  , _inbox_size(0)
+  , _drain_posted(false)
+{}
+
+//------------------------------------------------------------------------------
+// One drain is posted for however many datagrams pile up before it runs.
+void MemoryTransport::enqueue(ID source, const char* data, size_t size) {
+  lock_guard<mutex> lock(_inbox_mutex);
+
+  if (_inbox_size == _inbox.size()) _inbox.emplace_back();
+
+  auto& datagram = _inbox[_inbox_size++];
+  datagram.source = source;
+  datagram.data.assign(data, size);
+
+  if (_drain_posted) return;
+  _drain_posted = true;
+
+  // The hub detaches us before we go away, but the handler may
+  // still run after that.
+  auto destroyed = _destroy_guard.indicator();
+
+  _io_service.post([this, destroyed]() {
+      if (destroyed) return;
+      drain();
+      });
+}
+
+//------------------------------------------------------------------------------
+void MemoryTransport::drain() {
+  size_t count;
+
+  {
+    lock_guard<mutex> lock(_inbox_mutex);
+    _inbox.swap(_draining);
+    count         = _inbox_size;
+    _inbox_size   = 0;
+    _drain_posted = false;
+  }
+
+  // The receiver may close or destroy us.
+  auto destroyed = _destroy_guard.indicator();
+
+  for (size_t i = 0; i < count; ++i) {
+    if (destroyed || _is_closed) return;
+    const auto& datagram = _draining[i];
+    _receiver(datagram.source, datagram.data.data(), datagram.data.size());
+  }
+}
+
+//------------------------------------------------------------------------------
+void MemoryTransport::start(Receiver receiver) {
+  _receiver = move(receiver);
+}
+
+//------------------------------------------------------------------------------
+void MemoryTransport::send(ID destination, const char* data, size_t size) {
+  if (_is_closed) return;
+  _hub.send(_local_id, destination, data, size);
+}
+
+//------------------------------------------------------------------------------
+void MemoryTransport::close() {
+  if (_is_closed) return;
+  _is_closed = true;
+  _hub.detach(_local_id);
+}
+
+//------------------------------------------------------------------------------
+MemoryTransport::~MemoryTransport() {
+  close();
+}
@@ -0,0 +1,115 @@
+#ifndef __MEMORY_TRANSPORT_H__
+#define __MEMORY_TRANSPORT_H__
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Transport.h"
+#include "DestroyGuard.h"
+
+class MemoryTransport;
+
+// Stands in for the kernel when every node lives in the same process.
+// Datagrams are queued on the receiving transport, which drains its
+// queue from a handler posted on its own io_service, so nodes may be
+// spread over any number of threads and no file descriptors are used.
+//
+// The endpoint table is split into shards with a lock each, senders on
+// different threads rarely meet. Queued datagrams keep their buffers
+// once drained, a steady flow doesn't allocate.
+//
+// Loss and duplication can be injected to exercise the reliability code,
+// set them before any transport starts sending.
+class MemoryHub {
+public:
+  MemoryHub();
+
+  MemoryHub(const MemoryHub&)                  = delete;
+  const MemoryHub& operator=(const MemoryHub&) = delete;
+
+  void set_loss_probability(float p)      { _loss_probability = p; }
+  void set_duplicate_probability(float p) { _duplicate_probability = p; }
+
+  size_t sent_count()       const { return _sent_count; }
+  size_t sent_bytes()       const { return _sent_bytes; }
+  size_t dropped_count()    const { return _dropped_count; }
+  size_t duplicated_count() const { return _duplicated_count; }
+
+private:
+  friend class MemoryTransport;
+
+  ID attach(MemoryTransport&);
+  void detach(ID);
+  void send(ID source, ID destination, const char* data, size_t size);
+
+private:
+  static const size_t SHARD_COUNT = 64;
+
+  struct alignas(64) Shard {
+    std::mutex                                   mutex;
+    std::unordered_map<ID, MemoryTransport*>     transports;
+  };
+
+  Shard& shard_of(ID id) { return _shards[std::hash<ID>()(id) % SHARD_COUNT]; }
+
+private:
+  std::array<Shard, SHARD_COUNT> _shards;
+  std::atomic<uint32_t>          _next_address;
+
+  float _loss_probability;
+  float _duplicate_probability;
+
+  std::atomic<size_t> _sent_count;
+  std::atomic<size_t> _sent_bytes;
+  std::atomic<size_t> _dropped_count;
+  std::atomic<size_t> _duplicated_count;
+};
+
+class MemoryTransport : public Transport {
+public:
+  MemoryTransport(boost::asio::io_service&, MemoryHub&);
+
+  boost::asio::io_service& get_io_service() override { return _io_service; }
+  ID local_id() const override { return _local_id; }
+
+  void start(Receiver) override;
+  void send(ID, const char* data, size_t size) override;
+  void close() override;
+
+  ~MemoryTransport();
+
+private:
+  friend class MemoryHub;
+
+  struct Datagram {
+    ID          source;
+    std::string data;
+  };
+
+  // Called by the hub, from any thread.
+  void enqueue(ID source, const char* data, size_t size);
+  void drain();
+
+private:
+  boost::asio::io_service& _io_service;
+  MemoryHub&               _hub;
+  ID                       _local_id;
+  Receiver                 _receiver;
+  bool                     _is_closed;
+
+  // Senders fill the first _inbox_size entries of _inbox, a drain
+  // swaps it with _draining. Entries are only ever overwritten, so
+  // their strings keep the memory they grew.
+  std::mutex               _inbox_mutex;
+  std::vector<Datagram>    _inbox;
+  size_t                   _inbox_size;
+  bool                     _drain_posted;
+  std::vector<Datagram>    _draining;
+
+  DestroyGuard             _destroy_guard;
+};
+
+#endif // ifndef __MEMORY_TRANSPORT_H__
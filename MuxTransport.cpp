@@ -0,0 +1,98 @@
+#include "MuxTransport.h"
+#include "constants.h"
+#include "protocol.h"
+
+namespace asio = boost::asio;
+using namespace std;
+
+// Destination and source local id.
+static const size_t MUX_HEADER_SIZE = 8;
+
+//------------------------------------------------------------------------------
+UdpMux::UdpMux(asio::io_service& ios)
+  : _socket(ios)
+  , _next_local(0)
+{
+  // Many nodes' worth of traffic queues up on this one socket.
+  _socket.set_receive_buffer_size(MUX_RECEIVE_BUFFER_SIZE);
+  _socket.set_receive_batch(MUX_DATAGRAMS_PER_RECEIVE);
+
+  _socket.start([this](ID sender, const char* data, size_t size) {
+      receive(sender, data, size);
+      });
+}
+
+//------------------------------------------------------------------------------
+// Local ids are never reused, so datagrams still in flight to a node
+// which is gone can't be mistaken for traffic to a new one.
+uint32_t UdpMux::attach(MuxTransport& transport) {
+  uint32_t local = ++_next_local;
+  _transports[local] = &transport;
+  return local;
+}
+
+//------------------------------------------------------------------------------
+void UdpMux::detach(uint32_t local) {
+  _transports.erase(local);
+}
+
+//------------------------------------------------------------------------------
+// Like receiving, all muxes of a thread share one buffer to put
+// the header in front of the datagram.
+void UdpMux::send(uint32_t source, ID destination, const char* data, size_t size) {
+  static thread_local string out;
+  out.clear();
+
+  BinaryWriter w(out);
+  w.write_u32(destination.local());
+  w.write_u32(source);
+  out.append(data, size);
+
+  _socket.send(destination.endpoint(), out.data(), out.size());
+}
+
+//------------------------------------------------------------------------------
+void UdpMux::receive(ID sender, const char* data, size_t size) {
+  if (size < MUX_HEADER_SIZE) return;
+
+  BinaryReader r(data, MUX_HEADER_SIZE);
+  uint32_t destination = r.read_u32();
+  uint32_t source      = r.read_u32();
+
+  auto i = _transports.find(destination);
+  if (i == _transports.end()) return;
+
+  i->second->_receiver( ID(sender.endpoint(), source)
+                      , data + MUX_HEADER_SIZE
+                      , size - MUX_HEADER_SIZE);
+}
+
+//------------------------------------------------------------------------------
+MuxTransport::MuxTransport(UdpMux& mux)
+  : _mux(mux)
+  , _local_id(mux.local_endpoint(), mux.attach(*this))
+  , _is_closed(false)
+{}
+
+//------------------------------------------------------------------------------
+void MuxTransport::start(Receiver receiver) {
+  _receiver = move(receiver);
+}
+
+//------------------------------------------------------------------------------
+void MuxTransport::send(ID destination, const char* data, size_t size) {
+  if (_is_closed) return;
+  _mux.send(_local_id.local(), destination, data, size);
+}
+
+//------------------------------------------------------------------------------
+void MuxTransport::close() {
+  if (_is_closed) return;
+  _is_closed = true;
+  _mux.detach(_local_id.local());
+}
+
+//------------------------------------------------------------------------------
+MuxTransport::~MuxTransport() {
+  close();
+}
@@ -0,0 +1,65 @@
+#ifndef __MUX_TRANSPORT_H__
+#define __MUX_TRANSPORT_H__
+
+#include <unordered_map>
+#include "UdpTransport.h"
+
+class MuxTransport;
+
+// One UDP socket shared by any number of nodes on the same io_service.
+// Every datagram is prefixed with the local ids of its destination and
+// source, which is how the single receive loop finds the node it is for.
+// Nodes on a mux can only talk to nodes on a mux.
+class UdpMux {
+public:
+  explicit UdpMux(boost::asio::io_service&);
+
+  UdpMux(const UdpMux&)                  = delete;
+  const UdpMux& operator=(const UdpMux&) = delete;
+
+  boost::asio::io_service& get_io_service() { return _socket.get_io_service(); }
+  Endpoint local_endpoint() const { return _socket.local_id().endpoint(); }
+
+  size_t size() const { return _transports.size(); }
+
+  // Stops receiving for every node on the mux.
+  void close() { _socket.close(); }
+
+private:
+  friend class MuxTransport;
+
+  uint32_t attach(MuxTransport&);
+  void detach(uint32_t local);
+  void send(uint32_t source, ID destination, const char* data, size_t size);
+  void receive(ID sender, const char* data, size_t size);
+
+private:
+  UdpTransport                                _socket;
+  uint32_t                                    _next_local;
+  std::unordered_map<uint32_t, MuxTransport*> _transports;
+};
+
+// A node's view of a UdpMux.
+class MuxTransport : public Transport {
+public:
+  explicit MuxTransport(UdpMux&);
+
+  boost::asio::io_service& get_io_service() override { return _mux.get_io_service(); }
+  ID local_id() const override { return _local_id; }
+
+  void start(Receiver) override;
+  void send(ID, const char* data, size_t size) override;
+  void close() override;
+
+  ~MuxTransport();
+
+private:
+  friend class UdpMux;
+
+  UdpMux&  _mux;
+  ID       _local_id;
+  Receiver _receiver;
+  bool     _is_closed;
+};
+
+#endif // ifndef __MUX_TRANSPORT_H__
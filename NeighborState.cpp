@@ -0,0 +1,293 @@
+#include <algorithm>
+#include "NeighborState.h"
+
+using namespace std;
+
+const NeighborState::Slot NeighborState::no_slot;
+
+static bool is_decided(LeaderStatus s) { return s != LeaderStatus::undecided; }
+
+//------------------------------------------------------------------------------
+NeighborState::NeighborState() {
+  recount();
+}
+
+//------------------------------------------------------------------------------
+void NeighborState::set_number(Slot s, uint64_t n) {
+  bool is_contender = test(s, contender);
+
+  if (!test(s, has_number)) {
+    set(s, has_number);
+    if (is_contender) --_missing_numbers;
+  }
+
+  _number[s] = n;
+
+  if (is_contender && is_smallest(n, _id[s])) _min_slot = s;
+}
+
+//------------------------------------------------------------------------------
+bool NeighborState::is_smallest(uint64_t number, const ID& id) const {
+  if (_min_slot == no_slot) return true;
+
+  auto min_number = _number[_min_slot];
+  if (number != min_number) return number < min_number;
+  return id < _id[_min_slot];
+}
+
+//------------------------------------------------------------------------------
+void NeighborState::set_update1(Slot s, LeaderStatus status) {
+  if (!test(s, has_update1)) {
+    set(s, has_update1);
+    if (test(s, contender)) --_missing_update1;
+  }
+  else if (_update1[s] == LeaderStatus::leader) {
+    --_update1_leaders;
+  }
+
+  _update1[s] = status;
+  if (status == LeaderStatus::leader) ++_update1_leaders;
+}
+
+//------------------------------------------------------------------------------
+void NeighborState::set_update2(Slot s, LeaderStatus status) {
+  if (!test(s, has_update2)) {
+    set(s, has_update2);
+    if (test(s, contender)) --_missing_update2;
+  }
+  else if (_update2[s] == LeaderStatus::leader) {
+    --_update2_leaders;
+  }
+
+  _update2[s] = status;
+  if (status == LeaderStatus::leader) ++_update2_leaders;
+}
+
+//------------------------------------------------------------------------------
+void NeighborState::set_result(Slot s, LeaderStatus status) {
+  bool had_result  = test(s, has_result);
+  bool was_decided = had_result && is_decided(_result[s]);
+  bool was_leader  = had_result && _result[s] == LeaderStatus::leader;
+
+  set(s, has_result);
+  _result[s] = status;
+
+  if (was_decided != is_decided(status)) {
+    if (was_decided) ++_undecided; else --_undecided;
+  }
+
+  if (was_leader) --_result_leaders;
+  if (status == LeaderStatus::leader) ++_result_leaders;
+
+  if (is_decided(status)) drop_contender(s);
+}
+
+//------------------------------------------------------------------------------
+void NeighborState::set_joining(Slot s) {
+  if (test(s, joining)) return;
+  set(s, joining);
+  ++_joining;
+}
+
+//------------------------------------------------------------------------------
+void NeighborState::drop_contender(Slot s) {
+  auto f = _flags[s];
+  if (!(f & contender)) return;
+
+  clear(s, contender);
+  --_contenders;
+
+  if (!(f & has_number))  --_missing_numbers;
+  if (!(f & has_update1)) --_missing_update1;
+  if (!(f & has_update2)) --_missing_update2;
+
+  if (s == _min_slot) recount();
+}
+
+//------------------------------------------------------------------------------
+void NeighborState::restart() {
+  fill(_flags.begin(), _flags.end(), contender);
+  recount();
+}
+
+//------------------------------------------------------------------------------
+// Joining neighbors may have sent the number for their first round
+// already, only the contenders' ones are spent.
+void NeighborState::clear_numbers() {
+  for (auto& f : _flags) {
+    if (f & contender) f &= ~has_number;
+  }
+  _missing_numbers = _contenders;
+  _min_slot        = no_slot;
+}
+
+//------------------------------------------------------------------------------
+void NeighborState::clear_update1() {
+  clear_all(has_update1);
+  _missing_update1 = _contenders;
+  _update1_leaders = 0;
+}
+
+//------------------------------------------------------------------------------
+void NeighborState::end_round() {
+  for (Slot s = 0; s != size(); ++s) {
+    if (test(s, contender) && is_decided(_update2[s])) {
+      clear(s, contender);
+    }
+
+    if (test(s, joining)) {
+      clear(s, joining);
+      set(s, contender);
+    }
+  }
+
+  clear_all(has_update2);
+
+  // Numbers of the next round may have arrived already, and the
+  // ones from neighbors that stopped contending don't count anymore.
+  recount();
+}
+
+//------------------------------------------------------------------------------
+void NeighborState::push_back(const ID& id) {
+  _flags.push_back(0);
+  _id.push_back(id);
+  _number.push_back(0);
+  _update1.push_back(LeaderStatus::undecided);
+  _update2.push_back(LeaderStatus::undecided);
+  _result.push_back(LeaderStatus::undecided);
+  ++_undecided;
+
+  if (size() * 2 > _index.size()) {
+    reindex(max<size_t>(8, _index.size() * 2));
+  }
+  else {
+    index_insert(size() - 1);
+  }
+}
+
+//------------------------------------------------------------------------------
+void NeighborState::swap_remove(Slot s) {
+  Slot last = size() - 1;
+
+  index_erase(s);
+
+  if (s != last) {
+    auto i = home(_id[last]);
+    while (_index[i] != last) i = next(i);
+    _index[i] = s;
+  }
+
+  _flags[s]   = _flags.back();   _flags.pop_back();
+  _id[s]      = _id.back();      _id.pop_back();
+  _number[s]  = _number.back();  _number.pop_back();
+  _update1[s] = _update1.back(); _update1.pop_back();
+  _update2[s] = _update2.back(); _update2.pop_back();
+  _result[s]  = _result.back();  _result.pop_back();
+
+  // The minimum can't be taken back, removals are rare enough.
+  recount();
+}
+
+//------------------------------------------------------------------------------
+void NeighborState::clear() {
+  _flags.clear();
+  _id.clear();
+  _number.clear();
+  _update1.clear();
+  _update2.clear();
+  _result.clear();
+  _index.clear();
+  recount();
+}
+
+//------------------------------------------------------------------------------
+NeighborState::Slot NeighborState::find(const ID& id) const {
+  if (_index.empty()) return no_slot;
+
+  for (auto i = home(id);; i = next(i)) {
+    Slot s = _index[i];
+    if (s == no_slot || _id[s] == id) return s;
+  }
+}
+
+//------------------------------------------------------------------------------
+size_t NeighborState::memory_usage() const {
+  return _flags.capacity()   * sizeof(uint8_t)
+       + _id.capacity()      * sizeof(ID)
+       + _number.capacity()  * sizeof(uint64_t)
+       + _update1.capacity() * sizeof(LeaderStatus)
+       + _update2.capacity() * sizeof(LeaderStatus)
+       + _result.capacity()  * sizeof(LeaderStatus)
+       + _index.capacity()   * sizeof(Slot);
+}
+
+//------------------------------------------------------------------------------
+void NeighborState::index_insert(Slot s) {
+  auto i = home(_id[s]);
+  while (_index[i] != no_slot) i = next(i);
+  _index[i] = s;
+}
+
+//------------------------------------------------------------------------------
+// Entries after the freed position move back into it unless that would
+// put them before their home position, so that probing never has to
+// skip over holes.
+void NeighborState::index_erase(Slot s) {
+  auto i = home(_id[s]);
+  while (_index[i] != s) i = next(i);
+
+  _index[i] = no_slot;
+
+  for (auto j = next(i); _index[j] != no_slot; j = next(j)) {
+    auto h = home(_id[_index[j]]);
+
+    bool stays = i <= j ? (i < h && h <= j) : (i < h || h <= j);
+    if (stays) continue;
+
+    _index[i] = _index[j];
+    _index[j] = no_slot;
+    i = j;
+  }
+}
+
+//------------------------------------------------------------------------------
+void NeighborState::reindex(size_t capacity) {
+  _index.assign(capacity, no_slot);
+  for (Slot s = 0; s != size(); ++s) index_insert(s);
+}
+
+//------------------------------------------------------------------------------
+void NeighborState::recount() {
+  _contenders      = 0;
+  _missing_numbers = 0;
+  _missing_update1 = 0;
+  _missing_update2 = 0;
+  _undecided       = 0;
+  _update1_leaders = 0;
+  _update2_leaders = 0;
+  _result_leaders  = 0;
+  _joining         = 0;
+  _min_slot        = no_slot;
+
+  for (Slot s = 0; s != size(); ++s) {
+    auto f = _flags[s];
+
+    if (f & contender) {
+      ++_contenders;
+
+      if (!(f & has_update1)) ++_missing_update1;
+      if (!(f & has_update2)) ++_missing_update2;
+
+      if (!(f & has_number))  ++_missing_numbers;
+      else if (is_smallest(_number[s], _id[s])) _min_slot = s;
+    }
+
+    if ((f & has_update1) && _update1[s] == LeaderStatus::leader) ++_update1_leaders;
+    if ((f & has_update2) && _update2[s] == LeaderStatus::leader) ++_update2_leaders;
+
+    if (!(f & has_result) || !is_decided(_result[s])) ++_undecided;
+    if ((f & has_result) && _result[s] == LeaderStatus::leader) ++_result_leaders;
+    if (f & joining) ++_joining;
+  }
+}
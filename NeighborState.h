@@ -0,0 +1,135 @@
+#ifndef __NEIGHBOR_STATE_H__
+#define __NEIGHBOR_STATE_H__
+
+#include <cstdint>
+#include <vector>
+#include "ID.h"
+#include "LeaderStatus.h"
+
+// FastMIS state of a node's neighbors, one entry per connection slot.
+// Every field is an array of its own, the phase checks look at one or
+// two fields of every neighbor and so walk contiguous memory.
+//
+// Alongside the arrays it keeps running totals for the questions the
+// state machine asks after every message (is the phase complete, what is
+// the smallest priority, is there a leader around), so that a received
+// message costs O(1). Only the once per round transitions scan the
+// arrays.
+//
+// It also indexes the slots by neighbor ID, in an open addressing table
+// of slot numbers that probes the ID array itself, so looking a sender
+// up allocates nothing and costs no per entry heap node.
+class NeighborState {
+public:
+  using Slot = uint32_t;
+
+  static const Slot no_slot = Slot(-1);
+
+  enum Flag : uint8_t {
+    contender       = 1 << 0,
+    knows_my_result = 1 << 1,
+    has_number      = 1 << 2,
+    has_update1     = 1 << 3,
+    has_update2     = 1 << 4,
+    has_result      = 1 << 5,
+    joining         = 1 << 6, // Becomes a contender next round
+  };
+
+public:
+  NeighborState();
+
+  size_t size() const { return _flags.size(); }
+
+  // Slot of the neighbor, no_slot if it isn't one.
+  Slot find(const ID&) const;
+
+  // Heap memory held by the arrays and the index.
+  size_t memory_usage() const;
+
+  bool test(Slot s, Flag f) const { return _flags[s] & f; }
+  void set(Slot s, Flag f)        { _flags[s] |= f; }
+  void clear(Slot s, Flag f)      { _flags[s] &= ~f; }
+
+  // Messages from the neighbor in slot 's'.
+  void set_number(Slot s, uint64_t);
+  void set_update1(Slot s, LeaderStatus);
+  void set_update2(Slot s, LeaderStatus);
+  // A decided result also takes the neighbor out of the contenders.
+  void set_result(Slot s, LeaderStatus);
+
+  // A neighbor that started repairing while we are in the middle
+  // of a round.
+  void set_joining(Slot s);
+
+  bool has_number_from_all_contenders()  const { return _missing_numbers == 0; }
+  bool has_update1_from_all_contenders() const { return _missing_update1 == 0; }
+  bool has_update2_from_all_contenders() const { return _missing_update2 == 0; }
+  bool every_neighbor_decided()          const { return _undecided == 0; }
+  bool has_leader_neighbor() const { return _update1_leaders + _update2_leaders + _result_leaders != 0; }
+  bool has_leader_result()   const { return _result_leaders != 0; }
+  bool has_joining()         const { return _joining != 0; }
+
+  // Priorities are ordered by number, equal numbers by ID, so that
+  // no two nodes ever tie. True if ('number', 'id') is smaller than
+  // every priority received from a contender since the last
+  // clear_numbers().
+  bool is_smallest(uint64_t number, const ID& id) const;
+
+  // Every neighbor becomes a contender with nothing received.
+  void restart();
+
+  void clear_numbers();
+  void clear_update1();
+
+  // Neighbors that announced a decision in update2 stop being
+  // contenders, then the update2 values are dropped. Joining
+  // neighbors become contenders.
+  void end_round();
+
+  void push_back(const ID&);
+
+  // The last entry takes the place of the removed one.
+  void swap_remove(Slot s);
+
+  void clear();
+
+private:
+  void clear_all(Flag f) {
+    for (auto& fl : _flags) fl &= ~f;
+  }
+
+  void drop_contender(Slot s);
+  void recount();
+
+  size_t home(const ID& id) const {
+    return std::hash<ID>()(id) & (_index.size() - 1);
+  }
+
+  size_t next(size_t i) const { return (i + 1) & (_index.size() - 1); }
+
+  void index_insert(Slot s);
+  void index_erase(Slot s);
+  void reindex(size_t capacity);
+
+private:
+  std::vector<uint8_t>      _flags;
+  std::vector<ID>           _id;
+  std::vector<uint64_t>     _number;
+  std::vector<LeaderStatus> _update1;
+  std::vector<LeaderStatus> _update2;
+  std::vector<LeaderStatus> _result;
+  std::vector<Slot>         _index; // At most half full, no_slot when free
+
+  size_t _contenders;
+  size_t _missing_numbers;  // Contenders we have no number from
+  size_t _missing_update1;
+  size_t _missing_update2;
+  size_t _undecided;        // Neighbors without a decided result
+  size_t _update1_leaders;
+  size_t _update2_leaders;
+  size_t _result_leaders;
+  size_t _joining;
+  Slot   _min_slot;         // Contender with the smallest priority
+};
+
+#endif // ifndef __NEIGHBOR_STATE_H__
@@ -2,179 +2,189 @@
 
 #include "Node.h"
 #include "Connection.h"
-#include "Random.h"
+#include "UdpTransport.h"
 #include "constants.h"
 #include "protocol.h"
-#include "log.h"
+#include "Trace.h"
 
 namespace asio = boost::asio;
-using udp = asio::ip::udp;
 using namespace std;
-using ErrorCode = boost::system::error_code;
 
-Node::Node(boost::asio::io_service& ios)
-  : _io_service(ios)
-  , _socket(ios, udp::endpoint(udp::v4(), 0)) // Assign random port
-  , _id(_socket.local_endpoint())
+Node::Node(asio::io_service& ios)
+  : Node(unique_ptr<Transport>(new UdpTransport(ios)))
+{}
+
+Node::Node(unique_ptr<Transport> transport)
+  : _transport(move(transport))
+  , _io_service(_transport->get_io_service())
+  , _id(_transport->local_id())
   , _was_shut_down(false)
   , _ping_timeout(boost::posix_time::milliseconds(PING_TIMEOUT_MS))
   , _max_missed_ping_count(MAX_MISSED_PING_COUNT)
+  , _coalesce_delay(boost::posix_time::milliseconds(COALESCE_DELAY_MS))
+  , _wire_format(WireFormat::binary)
   , _state(idle)
+  , _state_since(chrono::steady_clock::now())
+  , _random_key(Philox::make_key(hash<ID>()(_id)))
 {
-  receive_data();
+  _transport->start([this](ID sender, const char* data, size_t size) {
+      use_data(sender, data, size);
+      });
 }
 
 void Node::shutdown() {
   _was_shut_down = true;
-  _socket.close();
-  _connections.clear();
-}
-
-void Node::receive_data() {
-  struct ServerData {
-    std::vector<char> data;
-    udp::endpoint     sender_endpoint;
-
-    ServerData() : data(MAX_DATAGRAM_SIZE) {}
-  };
-
-  auto server_data = make_shared<ServerData>();
-  auto destroyed   = _destroy_guard.indicator();
-
-  _socket.async_receive_from
-    ( asio::buffer(server_data->data)
-    , server_data->sender_endpoint
-    , [this, server_data, destroyed](const ErrorCode& ec, std::size_t size) {
-        if (destroyed) return;
-        if (_was_shut_down) return;
-
-        if (ec) {
-          if (ec != asio::error::operation_aborted) {
-            receive_data();
-          }
-          return;
-        }
-
-        use_data( server_data->sender_endpoint
-                , string( server_data->data.begin()
-                        , server_data->data.begin() + size));
+  _transport->close();
+  for (auto c : _connections) {
+    _counters += c->_counters;
+    _connection_pool.destroy(c);
+  }
 
-        receive_data();
-      });
+  // A dead node won't connect again, its memory goes back in one go.
+  _connections = Connections();
+  _connection_pool.release();
+  _neighbors = NeighborState();
 }
 
-void Node::use_data(Endpoint sender, string&& data) {
+void Node::use_data(ID sender, const char* data, size_t size) {
+  // Datagrams from peers we have no connection with yet count
+  // on the node.
+  auto slot = _neighbors.find(sender);
+  auto& counters = slot == NeighborState::no_slot ? _counters
+                                                  : _connections[slot]->_counters;
+  ++counters.datagrams_in;
+  counters.bytes_in += size;
+
   try {
-    std::stringstream ss(data);
-    dispatch_message(ss
-        , [&](const PingMsg& msg)    { use_data(sender, msg); }
-        , [&](const StartMsg& msg)   { use_data(sender, msg); }
-        , [&](const NumberMsg& msg)  { use_data(sender, msg); }
-        , [&](const Update1Msg& msg) { use_data(sender, msg); }
-        , [&](const Update2Msg& msg) { use_data(sender, msg); }
-        , [&](const ResultMsg& msg)  { use_data(sender, msg); });
+    dispatch_datagram(data, size, [&](const Message& msg) {
+        use_data(sender, msg);
+        });
   }
-  catch (const runtime_error& e) {
-    log(id(), " Problem reading message: ", e.what());
+  catch (const runtime_error&) {
+    TRACE(error, TraceEvent::parse_failure, id(), sender);
+    ++_counters.parse_failures;
     connection_lost(sender);
   }
 }
 
-template<class Msg>
-void Node::use_data(Endpoint sender, const Msg& msg) {
-  auto c_i = _connections.find(sender);
+void Node::use_data(ID sender, const Message& msg) {
+  // A handler of a previous message in the same datagram
+  // may have shut us down.
+  if (_was_shut_down) return;
+
+  auto slot = _neighbors.find(sender);
 
-  if (c_i == _connections.end()) {
+  Connection* c;
+
+  if (slot == NeighborState::no_slot) {
     // Only the first message can be used to establish connection.
     if (msg.sequence_number != 1) {
       return;
     }
-    c_i = create_connection(sender);
+    c = &create_connection(sender);
+  }
+  else {
+    c = _connections[slot];
   }
 
-  auto& c = *c_i->second;
-  c.receive(msg);
+  c->receive(msg);
 }
 
-Node::Connections::iterator Node::create_connection(Endpoint endpoint) {
-  auto c = unique_ptr<Connection>(new Connection(*this, endpoint));
-  auto pair = _connections.emplace(make_pair(endpoint, move(c)));
-  assert(pair.second);
-  return pair.first;
+Connection& Node::create_connection(ID remote_id) {
+  Slot slot = _connections.size();
+
+  // The neighbor entry goes first, the connection
+  // starts sending from its constructor.
+  _neighbors.push_back(remote_id);
+  _connections.push_back(_connection_pool.create(*this, remote_id, slot));
+
+  return *_connections.back();
 }
 
-void Node::connect(Endpoint remote_endpoint) {
-  if (_connections.count(remote_endpoint)) return;
-  create_connection(remote_endpoint);
+// The last connection takes the freed slot so
+// that all the slots stay contiguous.
+void Node::remove_connection(Slot slot) {
+  _counters += _connections[slot]->_counters;
+  _connection_pool.destroy(_connections[slot]);
+
+  Slot last = _connections.size() - 1;
+
+  if (slot != last) {
+    _connections[slot] = _connections[last];
+    _connections[slot]->_slot = slot;
+  }
+
+  _connections.pop_back();
+  _neighbors.swap_remove(slot);
 }
 
-void Node::connection_lost(Endpoint remote_endpoint) {
-  _connections.erase(remote_endpoint);
-  start_fast_mis();
+void Node::connect(ID remote_id) {
+  if (is_connected_to(remote_id)) return;
+  create_connection(remote_id);
 }
 
-bool Node::is_connected_to(Endpoint remote_endpoint) const {
-  return _connections.count(ID(remote_endpoint)) != 0;
+void Node::connection_lost(ID remote_id) {
+  auto slot = _neighbors.find(remote_id);
+  if (slot != NeighborState::no_slot) {
+    TRACE(info, TraceEvent::connection_lost, id(), remote_id);
+    ++_counters.connection_losses;
+    remove_connection(slot);
+  }
+
+  if (_fast_mis_started) {
+    continue_fast_mis();
+    return;
+  }
+
+  if (_recovery == Recovery::restart) {
+    start_fast_mis();
+    return;
+  }
+
+  // Leaders and followers with another leader around stay valid.
+  if (_leader_status == LeaderStatus::follower && !_neighbors.has_leader_result()) {
+    start_repair();
+  }
+}
+
+bool Node::is_connected_to(ID remote_id) const {
+  return _neighbors.find(remote_id) != NeighborState::no_slot;
 }
 
 template<class Message, class... Args> void Node::broadcast_contenders(Args... args) {
-  for (auto& pair : _connections) {
-    auto& c = *pair.second;
-    if (!c.is_contender) continue;
-    c.schedule_send<Message>(args...);
+  for (Slot s = 0; s != _connections.size(); ++s) {
+    if (!_neighbors.test(s, NeighborState::contender)) continue;
+    _connections[s]->schedule_send<Message>(args...);
   }
 }
 
 bool Node::has_number_from_all() const {
-  bool retval = true;
-  each_connection([&](const Connection& c) {
-      if (!c.is_contender) return;
-      if (!c.random_number) retval = false;
-      });
-  return retval;
+  return _neighbors.has_number_from_all_contenders();
 }
 
 bool Node::has_update1_from_all_contenders() const {
-  bool retval = true;
-  each_connection([&](const Connection& c) {
-      if (!c.is_contender) return;
-      if (!c.update1) retval = false;
-      });
-  return retval;
+  return _neighbors.has_update1_from_all_contenders();
 }
 
 bool Node::has_update2_from_all_contenders() const {
-  bool retval = true;
-  each_connection([&](const Connection& c) {
-      if (!c.is_contender) return;
-      if (!c.update2) retval = false;
-      });
-  return retval;
+  return _neighbors.has_update2_from_all_contenders();
 }
 
 bool Node::every_neighbor_decided() const {
-  bool retval = true;
-  each_connection([&](Connection& c) {
-      if (!c.result || *c.result == LeaderStatus::undecided) {
-        retval = false;
-      }});
-  return retval;
+  return _neighbors.every_neighbor_decided();
 }
 
-bool Node::smaller_than_others(float my_number) const {
-  bool retval = true;
-  each_connection([&](const Connection& c) {
-      if (!c.is_contender) return;
-      if (c.random_number && my_number >= c.random_number) {
-        retval = false;
-      }});
-  return retval;
+bool Node::smaller_than_others(uint64_t my_number) const {
+  // Joining neighbors have no number in this round to compare
+  // with and a known leader rules us out anyway.
+  if (_neighbors.has_joining() || _neighbors.has_leader_result()) return false;
+  return _neighbors.is_smallest(my_number, _id);
 }
 
 void Node::on_algorithm_completed() {
   assert(_fast_mis_started);
   _fast_mis_started = false;
-  log(id(), " !!! ", _leader_status, " !!!");
+  TRACE(info, TraceEvent::completed, id(), id(), 0, uint16_t(_leader_status));
   if (_on_algorithm_completed) {
     auto handler = _on_algorithm_completed;
     handler();
@@ -182,16 +192,7 @@ void Node::on_algorithm_completed() {
 }
 
 bool Node::has_leader_neighbor() const {
-  for (const auto& pair : _connections) {
-    const auto& c = *pair.second;
-    if (c.update1 && *c.update1 == LeaderStatus::leader) {
-      return true;
-    }
-    if (c.update2 && *c.update2 == LeaderStatus::leader) {
-      return true;
-    }
-  }
-  return false;
+  return _neighbors.has_leader_neighbor();
 }
 
 void Node::start_fast_mis() {
@@ -204,17 +205,10 @@ void Node::start_fast_mis() {
   // been set to new values by the algorithm, so it would
   // be a bug to reset them again.
   if (!_fast_mis_started) {
-    for (const auto& pair : _connections) {
-      auto& c = *pair.second;
-      // TODO: This should be in Connection
-      c.knows_my_result = false;
-      c.random_number = false;
-      c.update1.reset();
-      c.update2.reset();
-      c.result.reset();
-      c.is_contender = true;
-    }
-    _state = numbers;
+    _neighbors.restart();
+    ++_run;
+    _round = 0;
+    set_state(numbers);
     reset_all_numbers();
     _leader_status = LeaderStatus::undecided;
     broadcast_contenders<StartMsg>();
@@ -229,6 +223,63 @@ void Node::on_received_start() {
   start_fast_mis();
 }
 
+// Unlike start_fast_mis, decided neighbors keep their status. Every
+// neighbor counts as a contender until it answers the RepairMsg with
+// its result, as another neighbor of the lost node may be repairing
+// at the same time. Undecided neighbors are pulled in.
+void Node::start_repair() {
+  TRACE(info, TraceEvent::repair_started, id(), id());
+
+  _neighbors.restart();
+  ++_run;
+  _round = 0;
+  set_state(numbers);
+  reset_all_numbers();
+  _leader_status = LeaderStatus::undecided;
+  _fast_mis_started = true;
+
+  for (auto& c : _connections) {
+    c->schedule_send<RepairMsg>();
+  }
+
+  on_receive_number();
+}
+
+void Node::on_receive_repair(Slot slot) {
+  _neighbors.set_result(slot, LeaderStatus::undecided);
+  _neighbors.clear(slot, NeighborState::knows_my_result);
+
+  if (_leader_status != LeaderStatus::undecided) {
+    _neighbors.set(slot, NeighborState::knows_my_result);
+    _connections[slot]->schedule_send<ResultMsg>(_leader_status);
+    return;
+  }
+
+  if (!_fast_mis_started) {
+    start_repair();
+    return;
+  }
+
+  // We're in the middle of a round the sender takes no part in,
+  // it contends from the next one on.
+  if (!_neighbors.test(slot, NeighborState::contender)) {
+    _neighbors.set_joining(slot);
+  }
+}
+
+// A neighbor may leave the contenders at any point, which can
+// complete the phase we're waiting in.
+void Node::continue_fast_mis() {
+  switch (_state) {
+    case numbers:  on_receive_number();  break;
+    case updates1: on_receive_update1(); break;
+    case updates2: on_receive_update2(); break;
+    case idle:
+      if (every_neighbor_decided()) on_algorithm_completed();
+      break;
+  }
+}
+
 void Node::on_receive_number() {
   if (_state != numbers) return;
 
@@ -236,7 +287,7 @@ void Node::on_receive_number() {
   assert(_leader_status == LeaderStatus::undecided);
 
   if (!_my_random_number) {
-    _my_random_number = Random::instance().generate_float();
+    _my_random_number = generate_priority();
     broadcast_contenders<NumberMsg>(*_my_random_number);
   }
 
@@ -245,7 +296,7 @@ void Node::on_receive_number() {
   }
 
   if (smaller_than_others(*_my_random_number)) {
-    log(id(), " elected leader");
+    TRACE(debug, TraceEvent::elected_leader, id(), id(), *_my_random_number);
     _leader_status = LeaderStatus::leader;
   }
 
@@ -255,7 +306,7 @@ void Node::on_receive_number() {
 
   broadcast_contenders<Update1Msg>(_leader_status);
 
-  _state = updates1;
+  set_state(updates1);
   on_receive_update1();
 }
 
@@ -265,15 +316,15 @@ void Node::on_receive_update1() {
   if (!has_update1_from_all_contenders()) return;
 
   if (has_leader_neighbor()) {
-    log(id(), " has leader neigbor => follower");
+    TRACE(debug, TraceEvent::became_follower, id(), id());
     _leader_status = LeaderStatus::follower;
   }
 
-  each_connection([](Connection& c) { c.update1.reset(); });
+  _neighbors.clear_update1();
 
   broadcast_contenders<Update2Msg>(_leader_status);
 
-  _state = updates2;
+  set_state(updates2);
   on_receive_update2();
 }
 
@@ -282,49 +333,85 @@ void Node::on_receive_update2() {
 
   if (!has_update2_from_all_contenders()) return;
 
-  each_connection([&](Connection& c) {
-      if (!c.is_contender) return;
-      if (*c.update2 != LeaderStatus::undecided) {
-        c.is_contender = false;
-      }
-      });
-
-  each_connection([](Connection& c) { c.update2.reset(); });
+  _neighbors.end_round();
 
   if (_leader_status != LeaderStatus::undecided) {
-    _state = idle;
-    each_connection([&](Connection& c) {
-        if (c.knows_my_result) return;
-        c.knows_my_result = true;
-        c.schedule_send<ResultMsg>(_leader_status);
-        });
+    set_state(idle);
+    for (Slot s = 0; s != _connections.size(); ++s) {
+      if (_neighbors.test(s, NeighborState::knows_my_result)) continue;
+      _neighbors.set(s, NeighborState::knows_my_result);
+      _connections[s]->schedule_send<ResultMsg>(_leader_status);
+    }
 
     on_receive_result();
   }
   else {
-    _state = numbers;
+    set_state(numbers);
     on_receive_number();
   }
 }
 
 void Node::on_receive_result() {
-  assert(_fast_mis_started);
-  if (!every_neighbor_decided()) return;
-  on_algorithm_completed();
+  // Decided nodes hear about repairs of their neighbors too.
+  if (!_fast_mis_started) return;
+  continue_fast_mis();
+}
+
+void Node::set_random_seed(uint64_t seed) {
+  _random_key = Philox::make_key(seed ^ hash<ID>()(_id));
+}
+
+uint64_t Node::generate_priority() {
+  ++_counters.rounds;
+  auto r = Philox::generate({{ _round++, uint32_t(_run), uint32_t(_run >> 32), 0 }}
+                           , _random_key);
+  uint64_t priority = uint64_t(r[0]) << 32 | r[1];
+
+  // Neighbors get it as a float then, so we must compare that too.
+  if (_wire_format == WireFormat::text) priority = text_priority(priority);
+  return priority;
+}
+
+void Node::set_state(State state) {
+  auto now = chrono::steady_clock::now();
+  _counters.time_in_phase[_state] += now - _state_since;
+  _state_since = now;
+  _state       = state;
+}
+
+Counters Node::counters() const {
+  auto result = _counters;
+
+  for (auto c : _connections) result += c->_counters;
+
+  result.time_in_phase[_state] += chrono::steady_clock::now() - _state_since;
+  return result;
 }
 
 void Node::reset_all_numbers() {
   _my_random_number.reset();
-  each_connection([](Connection& c) { c.random_number.reset(); });
+  _neighbors.clear_numbers();
 }
 
 std::ostream& operator<<(std::ostream& os, const Node& node) {
   os << node.id() << "(" << node._leader_status << "): ";
-  for (const auto& pair : node._connections) {
-    os << pair.second->id() << " ";
+  for (const auto& c : node._connections) {
+    os << c->id() << " ";
   }
   return os;
 }
 
-Node::~Node() {}
+size_t Node::memory_usage() const {
+  size_t result = _connection_pool.memory_usage()
+                + _connections.capacity() * sizeof(Connection*)
+                + _neighbors.memory_usage();
+
+  for (auto c : _connections) result += c->memory_usage();
+
+  return result;
+}
+
+Node::~Node() {
+  for (auto c : _connections) _connection_pool.destroy(c);
+}
 
@@ -1,29 +1,39 @@
 #ifndef __NODE_H__
 #define __NODE_H__
 
-#include <map>
+#include <chrono>
 #include <set>
+#include <vector>
+#include <boost/asio.hpp>
 #include <boost/uuid/uuid.hpp>
 #include <boost/optional.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include "Counters.h"
 #include "Endpoint.h"
 #include "ID.h"
 #include "LeaderStatus.h"
 #include "DestroyGuard.h"
+#include "NeighborState.h"
+#include "Philox.h"
+#include "Pool.h"
+#include "protocol.h"
+#include "Transport.h"
 
 class Connection;
-class Message;
 
 class Node {
 private:
+  // Also indexes Counters::time_in_phase.
   enum State { idle, numbers, updates1, updates2 };
 
-  using ConnectionPtr = std::unique_ptr<Connection>;
-  using Connections   = std::map<ID, ConnectionPtr>;
+  using Connections   = std::vector<Connection*>; // By slot, from _connection_pool
+  using Slot          = NeighborState::Slot;
   using Duration      = boost::posix_time::time_duration;
 
 public:
+  // Talks UDP on a random port.
   Node(boost::asio::io_service& io_service);
+  Node(std::unique_ptr<Transport>);
 
   // Node is not movable because elements of _connections
   // hold a reference to this node.
@@ -34,12 +44,12 @@ public:
   ID id() const { return _id; }
 
   void shutdown();
-  void connect(Endpoint);
+  void connect(ID);
 
-  Endpoint local_endpoint() const { return _socket.local_endpoint(); }
+  Endpoint local_endpoint() const { return _id.endpoint(); }
   boost::asio::io_service& get_io_service() { return _io_service; }
 
-  bool is_connected_to(Endpoint) const;
+  bool is_connected_to(ID) const;
 
   template<class Handler> void start_fast_mis(const Handler& handler) {
     on_fast_mis_ended(handler);
@@ -54,37 +64,76 @@ public:
 
   bool is_running_mis() const { return _fast_mis_started; }
 
+  // What a node that isn't running the algorithm does when it
+  // loses a neighbor.
+  enum class Recovery {
+    restart, // The whole component elects again
+    repair   // Only nodes left without a leader neighbor elect again,
+             // together with their undecided neighbors
+  };
+
+  void set_recovery(Recovery recovery) { _recovery = recovery; }
+  Recovery recovery() const { return _recovery; }
+
+  // Priorities are a function of (seed, ID, run, round) only, so
+  // a run can be replayed no matter how its events interleave.
+  void set_random_seed(uint64_t);
+
   LeaderStatus leader_status() const { return _leader_status; }
 
+  // Rounds of the current or last run.
+  unsigned int rounds() const { return _round; }
+
+  // Totals of the node and all its connections, past ones included.
+  Counters counters() const;
+
   bool every_neighbor_decided() const;
 
   void set_ping_timeout(Duration duration) { _ping_timeout = duration; }
   void set_max_missed_ping_count(size_t n) { _max_missed_ping_count = n; }
 
-  template<class F> void each_connection(const F&f)       { for (auto& p : _connections) { f(*p.second); } }
-  template<class F> void each_connection(const F&f) const { for (const auto& p : _connections) { f(*p.second); } }
+  // How long a connection with messages in flight waits for more
+  // to pack into the same datagram. Idle connections don't wait.
+  void set_coalesce_delay(Duration duration) { _coalesce_delay = duration; }
+
+  // Format used for outgoing messages. Incoming messages are
+  // accepted in either format.
+  void set_wire_format(WireFormat format) { _wire_format = format; }
+  WireFormat wire_format() const { return _wire_format; }
+
+  template<class F> void each_connection(const F&f)       { for (auto& c : _connections) { f(*c); } }
+  template<class F> void each_connection(const F&f) const { for (const auto& c : _connections) { f(*c); } }
 
   ~Node();
 
   bool is_dead() const { return _was_shut_down; }
   size_t size() const { return _connections.size(); }
 
+  // Heap memory used by the node's connections and neighbor state,
+  // not counting the node itself nor its transport.
+  size_t memory_usage() const;
+
 private:
-  void receive_data();
-  void use_data(Endpoint sender, std::string&&);
-  template<class Msg> void use_data(Endpoint sender, const Msg& msg);
+  void use_data(ID sender, const char* data, size_t size);
+  void use_data(ID sender, const Message&);
 
-  Connections::iterator create_connection(Endpoint);
+  Connection& create_connection(ID);
+  void remove_connection(Slot);
 
   void on_receive_number();
   void on_received_start();
   void on_receive_update1();
   void on_receive_update2();
   void on_receive_result();
+  void on_receive_repair(Slot);
+  void start_repair();
+  void continue_fast_mis();
+  void set_state(State);
 
   friend class Connection;
 
-  bool smaller_than_others(float) const;
+  bool smaller_than_others(uint64_t) const;
+  uint64_t generate_priority();
   bool has_number_from_all() const;
   bool has_update1_from_all_contenders() const;
   bool has_update2_from_all_contenders() const;
@@ -95,32 +144,42 @@ private:
 
   template<class Message, class... Args> void broadcast_contenders(Args...);
 
-  boost::asio::ip::udp::socket& socket() { return _socket; }
+  Transport& transport() { return *_transport; }
 
   void reset_all_numbers();
 
-  void connection_lost(Endpoint);
+  void connection_lost(ID);
 
 private:
   friend std::ostream& operator<<(std::ostream&, const Node&);
 
+  std::unique_ptr<Transport>    _transport;
   boost::asio::io_service&      _io_service;
-  boost::asio::ip::udp::socket  _socket;
   ID                            _id;
+  Pool<Connection>              _connection_pool;
   Connections                   _connections;
   bool                          _was_shut_down;
+  Counters                      _counters; // Connections keep their own
 
   Duration      _ping_timeout;
   unsigned int  _max_missed_ping_count;
+  Duration      _coalesce_delay;
+  WireFormat    _wire_format;
 
   DestroyGuard  _destroy_guard;
 
   // FastMIS related data.
-  State                  _state;
-  LeaderStatus           _leader_status = LeaderStatus::undecided;
-  bool                   _fast_mis_started = false;
-  boost::optional<float> _my_random_number;
-  std::function<void()>  _on_algorithm_completed;
+  NeighborState             _neighbors; // By slot, same as _connections
+  State                     _state;
+  std::chrono::steady_clock::time_point _state_since;
+  LeaderStatus              _leader_status = LeaderStatus::undecided;
+  Recovery                  _recovery = Recovery::restart;
+  bool                      _fast_mis_started = false;
+  boost::optional<uint64_t> _my_random_number;
+  Philox::Key               _random_key;
+  uint64_t                  _run = 0;   // Restarts of the algorithm
+  uint32_t                  _round = 0; // Numbers drawn in this run
+  std::function<void()>     _on_algorithm_completed;
 };
 
 std::ostream& operator<<(std::ostream& os, const Node&);
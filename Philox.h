@@ -0,0 +1,54 @@
+#ifndef __PHILOX_H__
+#define __PHILOX_H__
+
+#include <array>
+#include <cstdint>
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel Random
+// Numbers: As Easy as 1, 2, 3", SC 2011).
+//
+// The output is a pure function of the key and the counter, so every
+// node can own a key and draw its numbers by counting, without any state
+// shared with other nodes and regardless of which thread runs it or in
+// which order events arrive.
+class Philox {
+public:
+  using Key     = std::array<uint32_t, 2>;
+  using Counter = std::array<uint32_t, 4>;
+
+  static Counter generate(Counter c, Key k) {
+    for (unsigned int i = 0; i < ROUNDS; ++i) {
+      if (i != 0) {
+        k[0] += W0;
+        k[1] += W1;
+      }
+
+      uint64_t p0 = uint64_t(M0) * c[0];
+      uint64_t p1 = uint64_t(M1) * c[2];
+
+      c = {{ uint32_t(p1 >> 32) ^ c[1] ^ k[0], uint32_t(p1)
+           , uint32_t(p0 >> 32) ^ c[3] ^ k[1], uint32_t(p0) }};
+    }
+    return c;
+  }
+
+  // Spreads a 64 bit seed over the key so that close seeds
+  // (e.g. consecutive node numbers) give unrelated streams.
+  static Key make_key(uint64_t seed) {
+    seed += 0x9e3779b97f4a7c15ULL;
+    seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+    seed ^= seed >> 31;
+    return {{ uint32_t(seed), uint32_t(seed >> 32) }};
+  }
+
+private:
+  static const unsigned int ROUNDS = 10;
+
+  static const uint32_t M0 = 0xD2511F53;
+  static const uint32_t M1 = 0xCD9E8D57;
+  static const uint32_t W0 = 0x9E3779B9;
+  static const uint32_t W1 = 0xBB67AE85;
+};
+
+#endif // ifndef __PHILOX_H__
@@ -0,0 +1,134 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Storage for objects of one type, carved out of chunks that double in
+// size up to a limit. Destroyed objects leave their slot to the next
+// one created, memory goes back to the heap only all at once, with
+// release() or when the pool goes away.
+//
+// Not thread safe, a pool belongs to whoever owns the objects.
+template<class T>
+class Pool {
+  union Slot {
+    Slot* next;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+public:
+  explicit Pool(size_t first_chunk = 4, size_t max_chunk = 1024)
+    : _free(nullptr)
+    , _first_chunk(std::max<size_t>(first_chunk, 1))
+    , _max_chunk(std::max(max_chunk, _first_chunk))
+    , _next_chunk(_first_chunk)
+    , _capacity(0)
+    , _live(0)
+  {}
+
+  Pool(Pool&& other)
+    : _chunks(std::move(other._chunks))
+    , _free(other._free)
+    , _first_chunk(other._first_chunk)
+    , _max_chunk(other._max_chunk)
+    , _next_chunk(other._next_chunk)
+    , _capacity(other._capacity)
+    , _live(other._live)
+  {
+    other._chunks.clear();
+    other._free       = nullptr;
+    other._next_chunk = other._first_chunk;
+    other._capacity   = 0;
+    other._live       = 0;
+  }
+
+  Pool(const Pool&)                  = delete;
+  const Pool& operator=(const Pool&) = delete;
+
+  // Objects still alive at this point are not destroyed.
+  ~Pool() { assert(_live == 0); }
+
+  template<class... Args> T* create(Args&&... args) {
+    Slot* slot = take();
+
+    try {
+      return new (slot->storage) T(std::forward<Args>(args)...);
+    }
+    catch (...) {
+      give_back(slot);
+      throw;
+    }
+  }
+
+  void destroy(T* object) {
+    object->~T();
+    give_back(reinterpret_cast<Slot*>(object));
+  }
+
+  // Frees every chunk. All objects must have been destroyed.
+  void release() {
+    assert(_live == 0);
+    _chunks.clear();
+    _chunks.shrink_to_fit();
+    _free       = nullptr;
+    _next_chunk = _first_chunk;
+    _capacity   = 0;
+  }
+
+  size_t size()     const { return _live; }
+  size_t capacity() const { return _capacity; }
+
+  // Heap memory held by the pool, bookkeeping included.
+  size_t memory_usage() const {
+    return _capacity * sizeof(Slot)
+         + _chunks.capacity() * sizeof(typename Chunks::value_type);
+  }
+
+private:
+  using Chunks = std::vector<std::unique_ptr<Slot[]>>;
+
+  Slot* take() {
+    if (!_free) grow();
+    Slot* slot = _free;
+    _free = slot->next;
+    ++_live;
+    return slot;
+  }
+
+  void give_back(Slot* slot) {
+    slot->next = _free;
+    _free = slot;
+    --_live;
+  }
+
+  void grow() {
+    size_t n = _next_chunk;
+    std::unique_ptr<Slot[]> chunk(new Slot[n]);
+
+    // Lowest addresses get handed out first.
+    for (size_t i = 0; i != n; ++i) {
+      chunk[i].next = i + 1 == n ? _free : &chunk[i + 1];
+    }
+
+    _free = &chunk[0];
+    _chunks.push_back(std::move(chunk));
+    _capacity  += n;
+    _next_chunk = std::min(n * 2, _max_chunk);
+  }
+
+private:
+  Chunks _chunks;
+  Slot*  _free;
+  size_t _first_chunk;
+  size_t _max_chunk;
+  size_t _next_chunk;
+  size_t _capacity;
+  size_t _live;
+};
+
+#endif // ifndef __POOL_H__
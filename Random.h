@@ -1,15 +1,19 @@
 #ifndef __RANDOM_H__
 #define __RANDOM_H__
 
+#include <atomic>
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_int_distribution.hpp>
 #include <boost/random/uniform_real_distribution.hpp>
 #include <boost/random/random_device.hpp>
 
+// Every thread gets its own generator so that nodes running on different
+// threads never share state. Seeding only affects the calling thread's
+// generator.
 class Random {
 public:
   static Random& instance() {
-    static Random random;
+    static thread_local Random random;
     return random;
   }
 
@@ -36,14 +40,18 @@ public:
     return generate_int(0, 1) == 1;
   }
 
-  // TODO: The algorithm probably shouldn't use floats.
   float generate_float() {
     boost::random::uniform_real_distribution<> dist(0.f, 1.f);
     return dist(_generator);
   }
 
 private:
-  Random() {}
+  // Threads which are never seeded explicitly still get
+  // distinct, reproducible sequences.
+  Random() {
+    static std::atomic<unsigned int> thread_count(0);
+    initialize_with_seed(boost::random::mt19937::default_seed + thread_count++);
+  }
 
 private:
   unsigned int _seed;
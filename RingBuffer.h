@@ -0,0 +1,76 @@
+#ifndef __RING_BUFFER_H__
+#define __RING_BUFFER_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+// FIFO of trivially copyable values, kept inside the owner for up to N
+// of them. A queue that outgrows that moves to the heap, doubling, and
+// keeps the bigger buffer, so once it reached its working size it never
+// allocates again.
+template<class T, size_t N>
+class RingBuffer {
+  static_assert(N != 0 && (N & (N - 1)) == 0, "N must be a power of two");
+  static_assert(std::is_trivially_copyable<T>::value,
+                "entries are moved around by copy");
+
+public:
+  RingBuffer() : _data(_inline), _capacity(N), _head(0), _size(0) {}
+
+  RingBuffer(const RingBuffer&)                  = delete;
+  const RingBuffer& operator=(const RingBuffer&) = delete;
+
+  ~RingBuffer() { if (_data != _inline) delete[] _data; }
+
+  size_t size()     const { return _size; }
+  size_t capacity() const { return _capacity; }
+  bool   empty()    const { return _size == 0; }
+
+  // Heap memory, zero while the entries fit inline.
+  size_t memory_usage() const {
+    return _data == _inline ? 0 : _capacity * sizeof(T);
+  }
+
+  // Counted from the front.
+  T&       operator[](size_t i)       { return _data[(_head + i) & (_capacity - 1)]; }
+  const T& operator[](size_t i) const { return _data[(_head + i) & (_capacity - 1)]; }
+
+  T&       front()       { return (*this)[0]; }
+  const T& front() const { return (*this)[0]; }
+  T&       back()        { return (*this)[_size - 1]; }
+  const T& back()  const { return (*this)[_size - 1]; }
+
+  void push_back(const T& value) {
+    if (_size == _capacity) grow();
+    (*this)[_size++] = value;
+  }
+
+  void pop_front() {
+    _head = (_head + 1) & (_capacity - 1);
+    --_size;
+  }
+
+  void clear() { _head = _size = 0; }
+
+private:
+  void grow() {
+    T* data = new T[_capacity * 2];
+    for (uint32_t i = 0; i < _size; ++i) data[i] = (*this)[i];
+
+    if (_data != _inline) delete[] _data;
+
+    _data      = data;
+    _capacity *= 2;
+    _head      = 0;
+  }
+
+private:
+  T*       _data;
+  uint32_t _capacity;
+  uint32_t _head;
+  uint32_t _size;
+  T        _inline[N];
+};
+
+#endif // ifndef __RING_BUFFER_H__
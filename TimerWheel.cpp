@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <cassert>
+#include "TimerWheel.h"
+
+namespace asio = boost::asio;
+using namespace std;
+using Error = boost::system::error_code;
+
+boost::asio::io_service::id TimerWheel::id;
+
+//------------------------------------------------------------------------------
+// Moves all entries of 'from' into the empty list 'to'.
+template<class Link>
+static void splice(Link& from, Link& to) {
+  assert(!to.is_linked());
+  if (!from.is_linked()) return;
+
+  to.next = from.next;
+  to.prev = from.prev;
+  to.next->prev = &to;
+  to.prev->next = &to;
+  from.prev = from.next = &from;
+}
+
+//------------------------------------------------------------------------------
+TimerWheel::TimerWheel(asio::io_service& ios)
+  : asio::io_service::service(ios)
+  , _kernel_timer(ios)
+  , _start(Clock::now())
+  , _now(0)
+  , _wakeup(0)
+  , _is_armed(false)
+  , _size(0)
+{}
+
+//------------------------------------------------------------------------------
+void TimerWheel::shutdown() {
+  _kernel_timer.cancel();
+  _is_armed = false;
+}
+
+//------------------------------------------------------------------------------
+// Durations beyond what the top level reaches are fine, insert() parks
+// such timers until they come within reach.
+void TimerWheel::schedule(Timer& timer, Duration duration) {
+  if (timer.is_linked()) {
+    timer.unlink();
+    --_size;
+  }
+
+  // Nothing to catch up on, skip the idle time.
+  if (_size == 0) _now = current_tick();
+
+  int64_t ticks = max<int64_t>(duration.total_milliseconds(), 1);
+
+  timer._expiry = current_tick() + ticks;
+  insert(timer);
+  ++_size;
+
+  if (!_is_armed || timer._expiry < _wakeup) arm_kernel_timer();
+}
+
+//------------------------------------------------------------------------------
+void TimerWheel::cancel(Timer& timer) {
+  if (!timer.is_linked()) return;
+
+  timer.unlink();
+  --_size;
+
+  // Don't keep the io_service running for nothing.
+  if (_size == 0 && _is_armed) {
+    _kernel_timer.cancel();
+    _is_armed = false;
+  }
+}
+
+//------------------------------------------------------------------------------
+// A timer goes to the lowest level whose slots still reach its expiry.
+// Expiries are counted from the clock but slots from _now, which lags
+// behind when the wheel is late, and timers may be scheduled further
+// out than the top level reaches, so an expiry can be out of reach.
+// Such a timer waits in the furthest top level slot and is placed
+// again when that one cascades, as often as it takes.
+void TimerWheel::insert(Timer& timer) {
+  unsigned int shift = 0;
+
+  for (unsigned int level = 0; level < LEVELS; ++level) {
+    shift = level * LEVEL_BITS;
+
+    if ((timer._expiry >> shift) - (_now >> shift) < SLOT_COUNT) {
+      timer.link_before(_slots[level][(timer._expiry >> shift) & SLOT_MASK]);
+      return;
+    }
+  }
+
+  auto furthest = (_now >> shift) + SLOT_COUNT - 1;
+  timer.link_before(_slots[LEVELS - 1][furthest & SLOT_MASK]);
+}
+
+//------------------------------------------------------------------------------
+void TimerWheel::advance_to(uint64_t tick) {
+  while (_now < tick && _size != 0) {
+    ++_now;
+
+    // Upper levels first so that their timers can trickle
+    // all the way down in one go.
+    for (unsigned int level = LEVELS - 1; level > 0; --level) {
+      uint64_t mask = (uint64_t(1) << (level * LEVEL_BITS)) - 1;
+      if ((_now & mask) == 0) cascade(level);
+    }
+
+    fire(_slots[0][_now & SLOT_MASK]);
+  }
+
+  _now = max(_now, tick);
+}
+
+//------------------------------------------------------------------------------
+void TimerWheel::cascade(unsigned int level) {
+  unsigned int shift = level * LEVEL_BITS;
+
+  Link list;
+  splice(_slots[level][(_now >> shift) & SLOT_MASK], list);
+
+  while (list.is_linked()) {
+    auto& timer = static_cast<Timer&>(*list.next);
+    timer.unlink();
+    insert(timer);
+  }
+}
+
+//------------------------------------------------------------------------------
+void TimerWheel::fire(Link& slot) {
+  // Callbacks may arm, cancel or destroy any timer, including the ones
+  // still waiting in this list, so take them off one at a time.
+  Link list;
+  splice(slot, list);
+
+  while (list.is_linked()) {
+    auto& timer = static_cast<Timer&>(*list.next);
+    timer.unlink();
+    --_size;
+    timer._callback();
+  }
+}
+
+//------------------------------------------------------------------------------
+// Every level only holds timers due within SLOT_COUNT of its slots, so it is
+// enough to look that far ahead on each. A timer on an upper level needs the
+// wheel to wake up when its slot cascades.
+uint64_t TimerWheel::next_wakeup() const {
+  for (unsigned int level = 0; level < LEVELS; ++level) {
+    unsigned int shift = level * LEVEL_BITS;
+    uint64_t     now   = _now >> shift;
+
+    for (uint64_t i = now + 1; i < now + SLOT_COUNT; ++i) {
+      if (_slots[level][i & SLOT_MASK].is_linked()) return i << shift;
+    }
+  }
+
+  return _now + 1;
+}
+
+//------------------------------------------------------------------------------
+void TimerWheel::arm_kernel_timer() {
+  if (_size == 0) {
+    if (_is_armed) _kernel_timer.cancel();
+    _is_armed = false;
+    return;
+  }
+
+  auto wakeup = next_wakeup();
+  if (_is_armed && wakeup == _wakeup) return;
+
+  _wakeup   = wakeup;
+  _is_armed = true;
+
+  _kernel_timer.expires_at(_start + chrono::milliseconds(wakeup));
+  _kernel_timer.async_wait([this](const Error& ec) {
+      if (ec == asio::error::operation_aborted) return;
+      _is_armed = false;
+      advance_to(current_tick());
+      arm_kernel_timer();
+      });
+}
+
+//------------------------------------------------------------------------------
+void TimerWheel::skip(Duration duration) {
+  _start -= chrono::milliseconds(duration.total_milliseconds());
+
+  // The kernel timer's deadline is absolute, it would now wake us late.
+  if (_is_armed) {
+    _kernel_timer.cancel();
+    _is_armed = false;
+    arm_kernel_timer();
+  }
+}
+
+//------------------------------------------------------------------------------
+uint64_t TimerWheel::current_tick() const {
+  using namespace chrono;
+  return duration_cast<milliseconds>(Clock::now() - _start).count();
+}
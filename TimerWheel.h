@@ -0,0 +1,122 @@
+#ifndef __TIMER_WHEEL_H__
+#define __TIMER_WHEEL_H__
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+// Hierarchical timer wheel shared by everything running on one io_service.
+//
+// Timers are intrusive list entries owned by their users, so arming and
+// cancelling them is O(1) and never allocates. The wheel itself keeps a
+// single kernel timer armed for the earliest slot that has something in
+// it, no matter how many timers are pending.
+class TimerWheel : public boost::asio::io_service::service {
+  using Clock = std::chrono::steady_clock;
+
+  static const unsigned int LEVEL_BITS = 6;
+  static const unsigned int SLOT_COUNT = 1 << LEVEL_BITS;
+  static const unsigned int SLOT_MASK  = SLOT_COUNT - 1;
+  static const unsigned int LEVELS     = 4;
+
+  struct Link {
+    Link* prev;
+    Link* next;
+
+    Link() : prev(this), next(this) {}
+
+    bool is_linked() const { return next != this; }
+
+    void unlink() {
+      prev->next = next;
+      next->prev = prev;
+      prev = next = this;
+    }
+
+    void link_before(Link& l) {
+      prev = l.prev;
+      next = &l;
+      l.prev->next = this;
+      l.prev = this;
+    }
+  };
+
+public:
+  using Duration = boost::posix_time::time_duration;
+
+  static boost::asio::io_service::id id;
+
+  class Timer : private Link {
+    friend class TimerWheel;
+
+  public:
+    template<class Callback>
+    Timer(boost::asio::io_service& ios, Callback&& callback)
+      : _wheel(boost::asio::use_service<TimerWheel>(ios))
+      , _expiry(0)
+      , _callback(std::forward<Callback>(callback))
+    {}
+
+    Timer(const Timer&)                  = delete;
+    const Timer& operator=(const Timer&) = delete;
+
+    // Re-arming an armed timer moves it.
+    void expires_from_now(Duration d) { _wheel.schedule(*this, d); }
+    void cancel() { _wheel.cancel(*this); }
+    bool is_armed() const { return is_linked(); }
+
+    ~Timer() { cancel(); }
+
+  private:
+    TimerWheel&           _wheel;
+    uint64_t              _expiry; // In ticks
+    std::function<void()> _callback;
+  };
+
+public:
+  explicit TimerWheel(boost::asio::io_service&);
+
+  TimerWheel(const TimerWheel&)                  = delete;
+  const TimerWheel& operator=(const TimerWheel&) = delete;
+
+  // One tick of the wheel.
+  static Duration resolution() { return boost::posix_time::milliseconds(1); }
+
+  size_t size() const { return _size; }
+
+  // Ticks since the wheel started, skip() included. What timers are
+  // measured against, so use it to time things that timers act on.
+  uint64_t tick_count() const { return current_tick(); }
+
+  // For testing only: moves the wheel's clock forward without waiting,
+  // the timers that became due fire from the io_service as usual.
+  void skip(Duration);
+
+private:
+  void shutdown() override;
+
+  void schedule(Timer&, Duration);
+  void cancel(Timer&);
+
+  void insert(Timer&);
+  void advance_to(uint64_t tick);
+  void cascade(unsigned int level);
+  void fire(Link& slot);
+  void arm_kernel_timer();
+  uint64_t next_wakeup() const;
+  uint64_t current_tick() const;
+
+private:
+  boost::asio::steady_timer _kernel_timer;
+  Clock::time_point         _start;
+  uint64_t                  _now;       // Last tick processed
+  uint64_t                  _wakeup;    // Tick the kernel timer is armed for
+  bool                      _is_armed;
+  size_t                    _size;      // Number of pending timers
+  Link                      _slots[LEVELS][SLOT_COUNT];
+};
+
+#endif // ifndef __TIMER_WHEEL_H__
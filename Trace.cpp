@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include "Trace.h"
+
+using namespace std;
+
+const size_t Trace::RING_SIZE;
+
+static_assert((Trace::RING_SIZE & (Trace::RING_SIZE - 1)) == 0,
+              "RING_SIZE must be a power of two");
+
+namespace {
+
+// Filled by one thread at a time, read by anyone.
+struct Ring {
+  atomic<uint64_t> head;  // Records written so far
+  TraceRecord      records[Trace::RING_SIZE];
+
+  Ring() : head(0) {}
+};
+
+// Rings outlive their threads so that a dump still shows what a finished
+// thread did. A new thread takes over a free ring instead of growing the
+// list.
+struct Registry {
+  mutex                    rings_mutex;
+  vector<unique_ptr<Ring>> rings;
+  vector<Ring*>            free;
+
+  Ring* acquire() {
+    lock_guard<mutex> lock(rings_mutex);
+
+    if (!free.empty()) {
+      auto ring = free.back();
+      free.pop_back();
+      return ring;
+    }
+
+    rings.emplace_back(new Ring);
+    return rings.back().get();
+  }
+
+  void release(Ring* ring) {
+    lock_guard<mutex> lock(rings_mutex);
+    free.push_back(ring);
+  }
+};
+
+// Threads may still exit after static destructors ran.
+Registry& registry() {
+  static Registry* r = new Registry;
+  return *r;
+}
+
+struct ThreadRing {
+  Ring* ring;
+
+  ThreadRing() : ring(registry().acquire()) {}
+  ~ThreadRing() { registry().release(ring); }
+};
+
+Ring& this_thread_ring() {
+  thread_local ThreadRing r;
+  return *r.ring;
+}
+
+void split(const ID& id, uint32_t& address, uint16_t& port, uint32_t& local) {
+  const auto& a = id.endpoint().address();
+
+  if (a.is_v4()) {
+    address = a.to_v4().to_uint();
+  }
+  else {
+    address = 0;
+    for (auto byte : a.to_v6().to_bytes()) address = address * 131 + byte;
+  }
+
+  port  = id.endpoint().port();
+  local = id.local();
+}
+
+struct Header {
+  char     magic[8];
+  uint32_t record_size;
+  uint32_t reserved;
+  uint64_t count;
+};
+
+const char MAGIC[8] = { 'F', 'M', 'T', 'R', 'A', 'C', 'E', '1' };
+
+} // namespace
+
+//------------------------------------------------------------------------------
+void Trace::write( TraceLevel level, TraceEvent event
+                 , const ID& node, const ID& peer
+                 , uint64_t value, uint16_t arg) {
+  using namespace chrono;
+
+  auto& ring = this_thread_ring();
+  auto  head = ring.head.load(memory_order_relaxed);
+  auto& r    = ring.records[head & (RING_SIZE - 1)];
+
+  r.time_ns = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+  r.value   = value;
+  split(node, r.node_address, r.node_port, r.node_local);
+  split(peer, r.peer_address, r.peer_port, r.peer_local);
+  r.level   = uint8_t(level);
+  r.event   = uint8_t(event);
+  r.arg     = arg;
+
+  ring.head.store(head + 1, memory_order_release);
+}
+
+//------------------------------------------------------------------------------
+vector<TraceRecord> Trace::snapshot() {
+  auto& reg = registry();
+  lock_guard<mutex> lock(reg.rings_mutex);
+
+  vector<TraceRecord> result;
+
+  for (auto& ring : reg.rings) {
+    auto head  = ring->head.load(memory_order_acquire);
+    auto count = min<uint64_t>(head, RING_SIZE);
+
+    for (auto i = head - count; i != head; ++i) {
+      result.push_back(ring->records[i & (RING_SIZE - 1)]);
+    }
+  }
+
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// Native byte order, the file is meant to be decoded on the same kind
+// of machine.
+void Trace::dump(ostream& os) {
+  auto records = snapshot();
+
+  Header header;
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.record_size = sizeof(TraceRecord);
+  header.reserved    = 0;
+  header.count       = records.size();
+
+  os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  os.write(reinterpret_cast<const char*>(records.data())
+          , records.size() * sizeof(TraceRecord));
+}
+
+//------------------------------------------------------------------------------
+vector<TraceRecord> Trace::read(istream& is) {
+  Header header;
+
+  if (!is.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+    throw runtime_error("Not a trace file");
+  }
+
+  if (header.record_size != sizeof(TraceRecord)) {
+    throw runtime_error("Unsupported trace record size");
+  }
+
+  vector<TraceRecord> records(header.count);
+
+  if (!is.read(reinterpret_cast<char*>(records.data())
+              , records.size() * sizeof(TraceRecord))) {
+    throw runtime_error("Truncated trace file");
+  }
+
+  return records;
+}
+
+//------------------------------------------------------------------------------
+const char* Trace::level_name(uint8_t level) {
+  static const char* names[] = { "none", "error", "info", "debug" };
+  return level < sizeof(names) / sizeof(*names) ? names[level] : "?";
+}
+
+//------------------------------------------------------------------------------
+const char* Trace::event_name(uint8_t event) {
+  static const char* names[] = { "send", "receive", "parse_failure"
+                               , "connection_lost", "elected_leader"
+                               , "became_follower", "repair_started"
+                               , "completed" };
+  return event < sizeof(names) / sizeof(*names) ? names[event] : "?";
+}
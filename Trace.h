@@ -0,0 +1,94 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+#include "ID.h"
+
+// Binary event trace. Every thread writes fixed size records into a ring
+// of its own, so writing is a clock read and a copy, with no locks and no
+// formatting. Rings are dumped with Trace::dump and turned into text
+// offline by tools/fastmis-trace.
+//
+// Levels above TRACE_LEVEL are compiled out, the arguments of their
+// TRACE() calls aren't even evaluated.
+#define TRACE_LEVEL_NONE  0
+#define TRACE_LEVEL_ERROR 1
+#define TRACE_LEVEL_INFO  2
+#define TRACE_LEVEL_DEBUG 3
+
+#ifndef TRACE_LEVEL
+# ifdef NDEBUG
+#   define TRACE_LEVEL TRACE_LEVEL_INFO
+# else
+#   define TRACE_LEVEL TRACE_LEVEL_DEBUG
+# endif
+#endif
+
+enum class TraceLevel : uint8_t {
+  error = TRACE_LEVEL_ERROR,
+  info  = TRACE_LEVEL_INFO,
+  debug = TRACE_LEVEL_DEBUG
+};
+
+enum class TraceEvent : uint8_t {
+  send,            // arg: message type, value: sequence number
+  receive,         // arg: message type, value: sequence number
+  parse_failure,
+  connection_lost,
+  elected_leader,  // value: priority
+  became_follower,
+  repair_started,
+  completed        // arg: leader status
+};
+
+struct TraceRecord {
+  uint64_t time_ns;      // Steady clock
+  uint64_t value;
+  uint32_t node_address; // IPv6 addresses are hashed
+  uint32_t node_local;
+  uint32_t peer_address;
+  uint32_t peer_local;
+  uint16_t node_port;
+  uint16_t peer_port;
+  uint8_t  level;
+  uint8_t  event;
+  uint16_t arg;
+};
+
+static_assert(sizeof(TraceRecord) == 40, "TraceRecord must stay packed");
+
+class Trace {
+public:
+  // Records per thread, older ones get overwritten.
+  static const size_t RING_SIZE = 1 << 12;
+
+  static constexpr bool enabled(TraceLevel level) {
+    return uint8_t(level) <= TRACE_LEVEL;
+  }
+
+  static void write( TraceLevel, TraceEvent, const ID& node, const ID& peer
+                   , uint64_t value = 0, uint16_t arg = 0);
+
+  // Records of every ring, each ring oldest first. Rings of running
+  // threads may be written to meanwhile, the oldest records of such
+  // a ring can come out torn.
+  static std::vector<TraceRecord> snapshot();
+
+  // Binary file: a header followed by the snapshot.
+  static void dump(std::ostream&);
+  static std::vector<TraceRecord> read(std::istream&);
+
+  static const char* level_name(uint8_t);
+  static const char* event_name(uint8_t);
+};
+
+#define TRACE(level, ...)                                   \
+  do {                                                      \
+    if (Trace::enabled(TraceLevel::level)) {                \
+      Trace::write(TraceLevel::level, __VA_ARGS__);         \
+    }                                                       \
+  } while (false)
+
+#endif // ifndef __TRACE_H__
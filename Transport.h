@@ -0,0 +1,35 @@
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+
+#include <functional>
+#include <string>
+#include <boost/asio.hpp>
+#include "Endpoint.h"
+#include "ID.h"
+
+// What a Node sends and receives datagrams through. Implementations
+// deliver whole datagrams to the receiver on the transport's io_service,
+// loss, duplication and reordering are all allowed.
+class Transport {
+public:
+  using Receiver = std::function<void(ID, const char*, size_t)>;
+
+  Transport() {}
+
+  Transport(const Transport&)                  = delete;
+  const Transport& operator=(const Transport&) = delete;
+
+  virtual boost::asio::io_service& get_io_service() = 0;
+  // Where other transports send to reach this one.
+  virtual ID local_id() const = 0;
+
+  // The receiver is called for every datagram until close().
+  virtual void start(Receiver) = 0;
+  // The data is only borrowed for the duration of the call.
+  virtual void send(ID destination, const char* data, size_t size) = 0;
+  virtual void close() = 0;
+
+  virtual ~Transport() {}
+};
+
+#endif // ifndef __TRANSPORT_H__
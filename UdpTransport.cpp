@@ -0,0 +1,110 @@
+#include "UdpTransport.h"
+#include "constants.h"
+
+namespace asio = boost::asio;
+using udp = asio::ip::udp;
+using namespace std;
+using ErrorCode = boost::system::error_code;
+
+//------------------------------------------------------------------------------
+UdpTransport::UdpTransport(asio::io_service& ios)
+  : _io_service(ios)
+  , _socket(ios, udp::endpoint(udp::v4(), 0)) // Assign random port
+  , _local_endpoint(_socket.local_endpoint())
+  , _receive_batch(MAX_DATAGRAMS_PER_RECEIVE)
+  , _is_closed(false)
+{
+  _socket.non_blocking(true);
+}
+
+//------------------------------------------------------------------------------
+void UdpTransport::start(Receiver receiver) {
+  _receiver = move(receiver);
+  receive_data();
+}
+
+//------------------------------------------------------------------------------
+void UdpTransport::send(ID destination, const char* data, size_t size) {
+  send(destination.endpoint(), data, size);
+}
+
+//------------------------------------------------------------------------------
+// The socket is non blocking, so a datagram normally leaves right away
+// straight from the caller's buffer. Only when the kernel's buffer is
+// full it takes a copy of its own to wait for room.
+void UdpTransport::send(Endpoint destination, const char* data, size_t size) {
+  if (_is_closed) return;
+
+  ErrorCode error;
+  _socket.send_to(asio::buffer(data, size), destination, 0, error);
+
+  if (error != asio::error::would_block) return;
+
+  auto copy = make_shared<string>(data, size);
+
+  _socket.async_send_to
+    ( asio::buffer(*copy)
+    , destination
+    , [copy](ErrorCode, size_t) {});
+}
+
+//------------------------------------------------------------------------------
+void UdpTransport::close() {
+  _is_closed = true;
+  _socket.close();
+}
+
+//------------------------------------------------------------------------------
+void UdpTransport::set_receive_buffer_size(size_t size) {
+  ErrorCode ignored;
+  _socket.set_option(udp::socket::receive_buffer_size(size), ignored);
+}
+
+//------------------------------------------------------------------------------
+// All transports served by one thread share a single receive buffer. The
+// socket is only read once it is known to be readable and each datagram is
+// fully processed before the next one overwrites the buffer, so no receive
+// ever needs a buffer of its own.
+static vector<char>& receive_buffer() {
+  static thread_local vector<char> buffer(MAX_DATAGRAM_SIZE);
+  return buffer;
+}
+
+//------------------------------------------------------------------------------
+void UdpTransport::receive_data() {
+  auto destroyed = _destroy_guard.indicator();
+
+  _socket.async_wait
+    ( udp::socket::wait_read
+    , [this, destroyed](const ErrorCode& ec) {
+        if (destroyed || _is_closed) return;
+
+        if (ec) {
+          if (ec != asio::error::operation_aborted) {
+            receive_data();
+          }
+          return;
+        }
+
+        auto& buffer = receive_buffer();
+
+        // Drain what is queued on the socket, but give other
+        // sockets a chance if a peer keeps flooding this one.
+        for (size_t i = 0; i < _receive_batch; ++i) {
+          ErrorCode     error;
+          udp::endpoint sender;
+
+          size_t size = _socket.receive_from( asio::buffer(buffer)
+                                            , sender, 0, error);
+
+          if (error == asio::error::would_block) break;
+          if (error) continue;
+
+          _receiver(sender, buffer.data(), size);
+
+          if (destroyed || _is_closed) return;
+        }
+
+        receive_data();
+      });
+}
@@ -0,0 +1,41 @@
+#ifndef __UDP_TRANSPORT_H__
+#define __UDP_TRANSPORT_H__
+
+#include "Transport.h"
+#include "DestroyGuard.h"
+
+class UdpTransport : public Transport {
+public:
+  // Binds to a random port on all interfaces.
+  explicit UdpTransport(boost::asio::io_service&);
+
+  boost::asio::io_service& get_io_service() override { return _io_service; }
+  ID local_id() const override { return _local_endpoint; }
+
+  void start(Receiver) override;
+  void send(ID, const char* data, size_t size) override;
+
+  // Sends to whatever endpoint the ID names, ignoring its local id.
+  void send(Endpoint, const char* data, size_t size);
+  void close() override;
+
+  // The kernel may cap it at its own limit.
+  void set_receive_buffer_size(size_t);
+
+  // How many datagrams are read before other handlers get a turn.
+  void set_receive_batch(size_t n) { _receive_batch = n; }
+
+private:
+  void receive_data();
+
+private:
+  boost::asio::io_service&     _io_service;
+  boost::asio::ip::udp::socket _socket;
+  Endpoint                     _local_endpoint;
+  Receiver                     _receiver;
+  size_t                       _receive_batch;
+  bool                         _is_closed;
+  DestroyGuard                 _destroy_guard;
+};
+
+#endif // ifndef __UDP_TRANSPORT_H__
@@ -0,0 +1,404 @@
+// Runs FastMIS end to end over in-memory networks and prints one record
+// per run, e.g.
+//
+//   fastmis-bench --nodes 1000,10000 --degree 4,16 --topology random,grid
+//   fastmis-bench --topology file:production.graph --snapshot result.bin
+//
+// Besides the shapes built here, rmat and ba give hub heavy networks
+// and geometric and torus high diameter ones, see tests/Generators.h.
+// Degrees apply to random, gnp, rmat, geometric and ba.
+//
+// Datagrams and bytes are the ones the nodes sent (pings included). Each
+// run goes in a child process of its own, so peak memory is the peak
+// resident size of that run alone. Bytes per connection is the heap the
+// nodes hold once the topology is built, divided by the number of
+// connections (two per edge).
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <boost/program_options.hpp>
+#include "Random.h"
+#include "IoServicePool.h"
+#include "MemoryTransport.h"
+#include "Trace.h"
+#include "tests/Generators.h"
+#include "tests/Network.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+struct Run {
+  string   topology;
+  size_t   nodes;
+  float    degree;
+  size_t   threads;
+  unsigned seed;
+  size_t   edges;
+  double   time_ms;
+  unsigned rounds;
+  size_t   datagrams;
+  size_t   bytes;
+  size_t   messages;
+  size_t   retransmits;
+  size_t   duplicates;
+  double   bytes_per_connection;
+  long     peak_rss_kb;
+  bool     is_mis;
+};
+
+//------------------------------------------------------------------------------
+template<class T> static vector<T> parse_list(const string& s) {
+  vector<T> result;
+  stringstream ss(s);
+  string item;
+
+  while (getline(ss, item, ',')) {
+    if (item.empty()) continue;
+    stringstream is(item);
+    T value;
+    if (!(is >> value)) throw runtime_error("Bad list value: " + item);
+    result.push_back(value);
+  }
+
+  return result;
+}
+
+//------------------------------------------------------------------------------
+static void connect(Network& network, size_t i, size_t j) {
+  network[i].connect(network[j].id());
+  network[j].connect(network[i].id());
+}
+
+//------------------------------------------------------------------------------
+static bool is_file(const string& topology) {
+  return topology.compare(0, 5, "file:") == 0;
+}
+
+static bool uses_degree(const string& topology) {
+  return topology == "random" || topology == "gnp" || topology == "rmat"
+      || topology == "geometric" || topology == "ba";
+}
+
+//------------------------------------------------------------------------------
+static void build( Network& network, const string& topology, size_t n, float degree
+                 , unsigned seed) {
+  if (is_file(topology)) {
+    network.add_topology(load_topology(topology.substr(5)));
+    return;
+  }
+
+  size_t w = max<size_t>(1, size_t(ceil(sqrt(double(n)))));
+
+  if (topology == "gnp") {
+    double p = n > 1 ? degree / (n - 1) : 0;
+    network.add_topology(gnp_graph(n, p, seed, true));
+    return;
+  }
+
+  if (topology == "rmat") {
+    network.add_topology(rmat_graph(n, size_t(n * degree / 2), seed, true));
+    return;
+  }
+
+  if (topology == "geometric") {
+    double radius = n ? sqrt(degree / (M_PI * n)) : 0;
+    network.add_topology(geometric_graph(n, radius, seed, true));
+    return;
+  }
+
+  if (topology == "ba") {
+    auto m = max<size_t>(1, size_t(round(degree / 2)));
+    network.add_topology(barabasi_albert_graph(n, m, seed));
+    return;
+  }
+
+  // Rounded down to whole rows.
+  if (topology == "torus") {
+    network.add_topology(grid_graph(w, max<size_t>(1, n / w), true));
+    return;
+  }
+
+  if (topology == "random") {
+    network.generate_connected(n, degree);
+    return;
+  }
+
+  network.add_nodes(n);
+
+  if (topology == "star") {
+    for (size_t i = 1; i < n; ++i) connect(network, 0, i);
+  }
+  else if (topology == "path") {
+    for (size_t i = 1; i < n; ++i) connect(network, i - 1, i);
+  }
+  else if (topology == "grid") {
+    for (size_t i = 0; i < n; ++i) {
+      if ((i + 1) % w != 0 && i + 1 < n) connect(network, i, i + 1);
+      if (i + w < n)                     connect(network, i, i + w);
+    }
+  }
+  else {
+    throw runtime_error("Unknown topology: " + topology);
+  }
+}
+
+//------------------------------------------------------------------------------
+static long peak_rss_kb() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+//------------------------------------------------------------------------------
+static void dump_trace(const string& path) {
+  ofstream file(path, ios::binary);
+  if (!file) throw runtime_error("Can't open " + path);
+  Trace::dump(file);
+}
+
+//------------------------------------------------------------------------------
+static Run run( const string& topology, size_t n, float degree
+              , size_t threads, unsigned seed, const string& snapshot) {
+  using Clock = chrono::steady_clock;
+
+  Random::instance().initialize_with_seed(seed);
+
+  IoServicePool pool(threads);
+  MemoryHub hub;
+
+  Network network(pool);
+  network.use_memory_hub(hub);
+  build(network, topology, n, degree, seed);
+
+  Run r = {};
+  r.topology = topology;
+  r.nodes    = network.size();
+  r.degree   = degree;
+  r.threads  = threads;
+  r.seed     = seed;
+
+  for (auto& node : network) {
+    node.each_connection([&](const Connection&) { ++r.edges; });
+  }
+  r.edges /= 2;
+
+  if (r.edges) {
+    r.bytes_per_connection = double(network.memory_usage()) / (2 * r.edges);
+  }
+
+  auto start = Clock::now();
+
+  // The handler runs on the shard that finished last, nodes on the
+  // others are read on their own shards.
+  network.start_fast_mis([&]() {
+      r.time_ms = chrono::duration<double, milli>(Clock::now() - start).count();
+
+      network.async_snapshot([&](const Network::Snapshot& s) {
+          r.is_mis = s.is_MIS();
+          if (!snapshot.empty()) save_binary_topology(snapshot, s.topology());
+          network.shutdown();
+          });
+      });
+
+  pool.run();
+
+  for (auto& node : network) r.rounds = max(r.rounds, node.rounds());
+
+  auto counters = network.counters();
+
+  r.datagrams   = counters.datagrams_out;
+  r.bytes       = counters.bytes_out;
+  r.messages    = counters.messages_out;
+  r.retransmits = counters.retransmits;
+  r.duplicates  = counters.duplicates;
+  r.peak_rss_kb = peak_rss_kb();
+
+  return r;
+}
+
+//------------------------------------------------------------------------------
+// Runs 'f' in a forked child and returns its exit status, the child
+// starts out as small as the parent, which never builds a network, so
+// its peak resident size is that of 'f' alone.
+template<class F> static int run_in_child(const F& f) {
+  // Or the child would print whatever is still buffered again.
+  cout.flush();
+
+  pid_t pid = fork();
+  if (pid < 0) throw runtime_error("Can't fork");
+
+  if (pid == 0) {
+    int status;
+
+    try {
+      status = f();
+    }
+    catch (const exception& e) {
+      cerr << e.what() << endl;
+      status = 2;
+    }
+
+    cout.flush();
+    _exit(status);
+  }
+
+  int status;
+  if (waitpid(pid, &status, 0) != pid) throw runtime_error("Can't wait for a run");
+
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 2;
+}
+
+//------------------------------------------------------------------------------
+static string json_string(const string& s) {
+  string result = "\"";
+
+  for (unsigned char c : s) {
+    switch (c) {
+      case '"':  result += "\\\""; break;
+      case '\\': result += "\\\\"; break;
+      case '\n': result += "\\n";  break;
+      case '\r': result += "\\r";  break;
+      case '\t': result += "\\t";  break;
+      default:
+        if (c < 0x20) {
+          char escaped[8];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          result += escaped;
+        }
+        else {
+          result += char(c);
+        }
+    }
+  }
+
+  return result + "\"";
+}
+
+//------------------------------------------------------------------------------
+static void print_csv_header(ostream& os) {
+  os << "topology,nodes,degree,threads,seed,edges,time_ms,rounds,"
+        "datagrams,bytes,messages,retransmits,duplicates,bytes_per_connection,"
+        "peak_rss_kb,is_mis" << endl;
+}
+
+static void print_csv(ostream& os, const Run& r) {
+  os << r.topology    << ',' << r.nodes     << ',' << r.degree  << ','
+     << r.threads     << ',' << r.seed      << ',' << r.edges   << ','
+     << r.time_ms     << ',' << r.rounds    << ',' << r.datagrams << ','
+     << r.bytes       << ',' << r.messages  << ',' << r.retransmits << ','
+     << r.duplicates  << ','
+     << r.bytes_per_connection << ',' << r.peak_rss_kb << ',' << r.is_mis
+     << endl;
+}
+
+static void print_json(ostream& os, const Run& r) {
+  os << "{\"topology\":"   << json_string(r.topology)
+     << ",\"nodes\":"       << r.nodes
+     << ",\"degree\":"      << r.degree
+     << ",\"threads\":"     << r.threads
+     << ",\"seed\":"        << r.seed
+     << ",\"edges\":"       << r.edges
+     << ",\"time_ms\":"     << r.time_ms
+     << ",\"rounds\":"      << r.rounds
+     << ",\"datagrams\":"   << r.datagrams
+     << ",\"bytes\":"       << r.bytes
+     << ",\"messages\":"    << r.messages
+     << ",\"retransmits\":" << r.retransmits
+     << ",\"duplicates\":"  << r.duplicates
+     << ",\"bytes_per_connection\":" << r.bytes_per_connection
+     << ",\"peak_rss_kb\":" << r.peak_rss_kb
+     << ",\"is_mis\":"      << (r.is_mis ? "true" : "false")
+     << "}" << endl;
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+  string nodes, degrees, topologies, format, trace, snapshot;
+  size_t threads, repeat;
+  unsigned seed;
+
+  po::options_description desc("Options");
+  desc.add_options()
+    ("help,h", "Print this help")
+    ("nodes,n",    po::value<string>(&nodes)->default_value("100,1000"),
+                   "Comma separated node counts")
+    ("degree,d",   po::value<string>(&degrees)->default_value("4"),
+                   "Comma separated expected degrees")
+    ("topology,t", po::value<string>(&topologies)->default_value("random,rmat,ba,geometric,torus"),
+                   "Comma separated topologies: random, gnp, rmat, geometric, "
+                   "ba, star, path, grid, torus, file:PATH (edge list, METIS "
+                   "or binary, see GraphFile.h)")
+    ("threads,j",  po::value<size_t>(&threads)->default_value(1),
+                   "Number of io_service threads")
+    ("repeat,r",   po::value<size_t>(&repeat)->default_value(1),
+                   "Runs per configuration, each with the next seed")
+    ("seed,s",     po::value<unsigned>(&seed)->default_value(1),
+                   "Seed of the first run")
+    ("format,f",   po::value<string>(&format)->default_value("csv"),
+                   "Output format: csv or json (one object per line)")
+    ("trace",      po::value<string>(&trace),
+                   "Dump the trace rings to this file after each run, the "
+                   "last run wins, decode it with fastmis-trace")
+    ("snapshot",   po::value<string>(&snapshot),
+                   "Save the topology and leader statuses of each run to this "
+                   "file in the binary graph format, the last run wins. Exact "
+                   "with a single thread");
+
+  try {
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      cout << desc << endl;
+      return 0;
+    }
+
+    if (format != "csv" && format != "json") {
+      throw runtime_error("Unknown format: " + format);
+    }
+
+    if (format == "csv") print_csv_header(cout);
+
+    bool all_mis = true;
+
+    for (auto& topology : parse_list<string>(topologies)) {
+      // Other topologies don't depend on the degree, files
+      // not on the node count either.
+      auto ds = uses_degree(topology) ? parse_list<float>(degrees)
+                                      : vector<float>(1, 0);
+      auto ns = is_file(topology) ? vector<size_t>(1, 0)
+                                  : parse_list<size_t>(nodes);
+
+      for (auto n : ns) {
+        for (auto d : ds) {
+          for (size_t i = 0; i < repeat; ++i) {
+            auto status = run_in_child([&]() {
+                auto r = run(topology, n, d, threads, seed + i, snapshot);
+                if (format == "csv") print_csv(cout, r); else print_json(cout, r);
+                if (!trace.empty()) dump_trace(trace);
+                return r.is_mis ? 0 : 1;
+                });
+
+            if (status > 1) return status;
+            all_mis = all_mis && status == 0;
+          }
+        }
+      }
+    }
+
+    return all_mis ? 0 : 1;
+  }
+  catch (const exception& e) {
+    cerr << e.what() << endl;
+    return 2;
+  }
+}
@@ -1,9 +1,19 @@
 #ifndef __CONSTANTS_H__
 #define __CONSTANTS_H__
 
-static const unsigned int PING_TIMEOUT_MS       = 100;
-static const unsigned int MAX_MISSED_PING_COUNT = 10;
-static const size_t       MAX_DATAGRAM_SIZE     = 2097152; // 2^21
+static const unsigned int PING_TIMEOUT_MS             = 100;
+static const unsigned int MAX_MISSED_PING_COUNT       = 10;
+static const size_t       MAX_DATAGRAM_SIZE           = 65536; // Largest UDP payload
+static const size_t       MAX_DATAGRAMS_PER_RECEIVE   = 64;
+static const unsigned int COALESCE_DELAY_MS           = 1;
+static const size_t       MAX_COALESCED_DATAGRAM_SIZE = 1472;  // Fits 1500 byte MTU
+static const size_t       WINDOW_SIZE                 = 32;    // Messages in flight
+static const unsigned int ACK_DELAY_MS                = 5;
+static const unsigned int MIN_RETRANSMIT_TIMEOUT_MS   = 2 * ACK_DELAY_MS; // Acks may wait that long
+static const unsigned int MAX_RETRANSMIT_BACKOFF      = 6;     // Doublings of the timeout
+static const size_t       MUX_RECEIVE_BUFFER_SIZE     = 4 << 20; // Shared by all nodes on a mux
+static const size_t       MUX_DATAGRAMS_PER_RECEIVE   = 1024;
 
-#endif // ifndef __CONSTANTS_H__
+static_assert(WINDOW_SIZE <= 32, "selective acks are sent as a 32 bit mask");
 
+#endif // ifndef __CONSTANTS_H__
@@ -1,171 +1,465 @@
 #ifndef __PROTOCOL_H__
 #define __PROTOCOL_H__
 
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 #include "LeaderStatus.h"
 
 //------------------------------------------------------------------------------
-struct Message {
-  uint32_t sequence_number;
-  uint32_t ack_sequence_number;
+// Every message can be put on the wire in one of two formats:
+//
+//   text:   "<label> <seq> <ack> <payload>\n" with decimal numbers and the
+//           status as U, F or L. This is what the original nodes speak,
+//           so priorities travel as floats in [0, 1) the way they drew
+//           them (see priority_to_float).
+//   binary: one type byte followed by big endian fixed width fields:
+//
+//             [0x80 | type : 1][seq : 4][ack : 4][ack bitmap : 4][payload]
+//
+//           where the payload is an 8 byte priority for NumberMsg, one
+//           byte of LeaderStatus for the update/result messages and empty
+//           otherwise. Only the binary format carries selective acks.
+//
+// Text labels are lowercase ASCII, so the high bit of the first byte tells
+// the two formats apart and a node can decode both regardless of which one
+// it is configured to send.
+enum class WireFormat { text, binary };
+
+enum class MessageType : uint8_t {
+  ping, start, number, update1, update2, result, repair
+};
 
-  virtual std::string label() const = 0;
-  virtual void to_stream(std::ostream&) const = 0;
+static const uint8_t BINARY_MESSAGE_BIT = 0x80;
 
-  Message(uint32_t sequence_number, uint32_t ack_sequence_number)
-    : sequence_number(sequence_number)
-    , ack_sequence_number(ack_sequence_number)
+inline bool is_binary_message(const char* data, size_t size) {
+  return size != 0 && (static_cast<uint8_t>(data[0]) & BINARY_MESSAGE_BIT);
+}
+
+//------------------------------------------------------------------------------
+class BinaryWriter {
+public:
+  BinaryWriter(std::string& out) : _out(out) {}
+
+  void write_u8(uint8_t v) { _out.push_back(static_cast<char>(v)); }
+
+  void write_u32(uint32_t v) {
+    char bytes[4] = { char(v >> 24), char(v >> 16), char(v >> 8), char(v) };
+    _out.append(bytes, sizeof(bytes));
+  }
+
+  void write_u64(uint64_t v) {
+    write_u32(uint32_t(v >> 32));
+    write_u32(uint32_t(v));
+  }
+
+  void write_status(LeaderStatus s) { write_u8(static_cast<uint8_t>(s)); }
+
+private:
+  std::string& _out;
+};
+
+//------------------------------------------------------------------------------
+class BinaryReader {
+public:
+  BinaryReader(const char* data, size_t size)
+    : _pos(reinterpret_cast<const uint8_t*>(data))
+    , _end(_pos + size)
   {}
 
-  Message(std::istream& is) { is >> sequence_number >> ack_sequence_number; }
-  
-  virtual ~Message() {}
+  uint8_t read_u8() {
+    require(1);
+    return *_pos++;
+  }
+
+  uint32_t read_u32() {
+    require(4);
+    uint32_t v = (uint32_t(_pos[0]) << 24) | (uint32_t(_pos[1]) << 16)
+               | (uint32_t(_pos[2]) << 8)  |  uint32_t(_pos[3]);
+    _pos += 4;
+    return v;
+  }
+
+  uint64_t read_u64() {
+    uint64_t high = read_u32();
+    return high << 32 | read_u32();
+  }
+
+  LeaderStatus read_status() {
+    uint8_t v = read_u8();
+    if (v > static_cast<uint8_t>(LeaderStatus::leader)) {
+      throw std::runtime_error("unrecognized leader status");
+    }
+    return static_cast<LeaderStatus>(v);
+  }
+
+  bool empty() const { return _pos == _end; }
+
+private:
+  void require(size_t n) const {
+    if (size_t(_end - _pos) < n) {
+      throw std::runtime_error("truncated message");
+    }
+  }
+
+private:
+  const uint8_t* _pos;
+  const uint8_t* _end;
 };
 
-inline std::ostream& operator<<(std::ostream& os, const Message& msg) {
-  os << msg.sequence_number << " " << msg.ack_sequence_number << " ";
-  msg.to_stream(os);
-  return os;
+//------------------------------------------------------------------------------
+// The original nodes draw priorities as floats in [0, 1). A float maps
+// onto the 64 bit range exactly, so their numbers compare with ours, and
+// a node speaking text rounds its own priorities to what the float on
+// the wire can carry (text_priority) so that both ends of a link compare
+// the same values.
+inline uint64_t priority_from_float(float f) {
+  if (!(f > 0)) return 0;
+  if (f >= 1)   return UINT64_MAX;
+  return uint64_t(std::ldexp(double(f), 64));
+}
+
+inline float priority_to_float(uint64_t priority) {
+  float f = float(std::ldexp(double(priority), -64));
+  return f < 1 ? f : std::nextafter(1.f, 0.f);
+}
+
+inline uint64_t text_priority(uint64_t priority) {
+  return priority_from_float(priority_to_float(priority));
 }
 
 //------------------------------------------------------------------------------
-struct PingMsg : Message {
-  using Message::Message;
-  std::string label() const override { return "ping"; }
-  void to_stream(std::ostream&) const override {}
+// Text counterpart of BinaryReader, parses in place without iostreams.
+class TextReader {
+public:
+  TextReader(const char* data, size_t size) : _pos(data), _end(data + size) {}
+
+  // True once only whitespace is left.
+  bool empty() {
+    skip_space();
+    return _pos == _end;
+  }
+
+  uint64_t read_uint() {
+    skip_space();
+
+    if (_pos == _end || !is_digit(*_pos)) {
+      throw std::runtime_error("expected a number");
+    }
+
+    uint64_t v = 0;
+    while (_pos != _end && is_digit(*_pos)) v = v * 10 + uint64_t(*_pos++ - '0');
+    return v;
+  }
+
+  // Parsed like the original nodes' "is >> float" does.
+  float read_float() {
+    size_t size;
+    const char* word = read_word(size);
+
+    char buffer[64];
+    if (size == 0 || size >= sizeof(buffer)) {
+      throw std::runtime_error("expected a number");
+    }
+
+    memcpy(buffer, word, size);
+    buffer[size] = '\0';
+
+    char* end;
+    float f = std::strtof(buffer, &end);
+
+    if (end != buffer + size) throw std::runtime_error("expected a number");
+    return f;
+  }
+
+  LeaderStatus read_status() {
+    size_t size;
+    const char* word = read_word(size);
+
+    if (size == 1) {
+      switch (*word) {
+        case 'U': return LeaderStatus::undecided;
+        case 'F': return LeaderStatus::follower;
+        case 'L': return LeaderStatus::leader;
+      }
+    }
+
+    throw std::runtime_error("unrecognized leader status");
+  }
+
+  // Whitespace separated, not terminated.
+  const char* read_word(size_t& size) {
+    skip_space();
+    const char* begin = _pos;
+    while (_pos != _end && !is_space(*_pos)) ++_pos;
+    size = _pos - begin;
+    return begin;
+  }
+
+private:
+  static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+  static bool is_space(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+  void skip_space() {
+    while (_pos != _end && is_space(*_pos)) ++_pos;
+  }
+
+private:
+  const char* _pos;
+  const char* _end;
 };
 
 //------------------------------------------------------------------------------
-struct StartMsg : Message {
-  using Message::Message;
-  std::string label() const override { return "start"; }
-  void to_stream(std::ostream&) const override {}
+class TextWriter {
+public:
+  TextWriter(std::string& out) : _out(out) {}
+
+  void write_word(const char* word) { _out += word; }
+  void write_space()                { _out += ' '; }
+  void write_end()                  { _out += '\n'; }
+
+  void write_uint(uint64_t v) {
+    char digits[20];
+    size_t n = 0;
+    do { digits[n++] = char('0' + v % 10); v /= 10; } while (v);
+    while (n) _out += digits[--n];
+  }
+
+  // Enough digits for the float to read back exactly.
+  void write_float(float f) {
+    char buffer[32];
+    int n = snprintf(buffer, sizeof(buffer), "%.9g", double(f));
+    _out.append(buffer, n);
+  }
+
+  void write_status(LeaderStatus s) {
+    static const char letters[] = { 'U', 'F', 'L' };
+    _out += letters[static_cast<uint8_t>(s)];
+  }
+
+private:
+  std::string& _out;
 };
 
 //------------------------------------------------------------------------------
-struct NumberMsg : Message {
-  std::string label() const override { return "number"; }
+inline const char* message_label(MessageType type) {
+  static const char* labels[] = { "ping", "start", "number", "update1"
+                                , "update2", "result", "repair" };
+  return labels[static_cast<uint8_t>(type)];
+}
+
+//------------------------------------------------------------------------------
+// Every message is a small trivially copyable value: the header, a type
+// tag and a payload whose meaning depends on the tag. Queues hold them by
+// value and nothing about a message ever touches the heap.
+//
+// The typed messages below only add constructors, so each of them is a
+// Message and a Message converts back to the type its tag names.
+struct Message {
+  uint32_t    sequence_number;
+  uint32_t    ack_sequence_number;
+  // Bit i acknowledges message ack_sequence_number + 2 + i.
+  uint32_t    ack_bitmap;
+  MessageType type;
 
-  float random_number;
+  union {
+    uint64_t     random_number; // number
+    LeaderStatus status;        // update1, update2, result
+  };
 
-  NumberMsg(uint32_t sequence_number, uint32_t ack_sequence_number
-       , float random_number)
-    : Message(sequence_number, ack_sequence_number)
-    , random_number(random_number)
+  Message() = default;
+
+  Message(MessageType type, uint32_t sequence_number, uint32_t ack_sequence_number)
+    : sequence_number(sequence_number)
+    , ack_sequence_number(ack_sequence_number)
+    , ack_bitmap(0)
+    , type(type)
+    , random_number(0)
   {}
 
-  NumberMsg(std::istream& is) : Message(is) {
-    is >> random_number;
-  }
+  const char* label() const { return message_label(type); }
 
-  void to_stream(std::ostream& os) const override {
-    os << random_number;
+  bool has_number() const { return type == MessageType::number; }
+
+  bool has_status() const {
+    return type == MessageType::update1 || type == MessageType::update2
+        || type == MessageType::result;
   }
 };
 
-//------------------------------------------------------------------------------
-struct Update1Msg : Message {
-  std::string label() const override { return "update1"; }
+static_assert(std::is_trivially_copyable<Message>::value,
+              "messages are copied around as plain bytes");
 
-  LeaderStatus status;
+//------------------------------------------------------------------------------
+template<MessageType T> struct EmptyMessage : Message {
+  static const MessageType TYPE = T;
 
-  Update1Msg(uint32_t sequence_number, uint32_t ack_sequence_number
-       , LeaderStatus status)
-    : Message(sequence_number, ack_sequence_number)
-    , status(status)
+  EmptyMessage(uint32_t sequence_number, uint32_t ack_sequence_number)
+    : Message(T, sequence_number, ack_sequence_number)
   {}
 
-  Update1Msg(std::istream& is) : Message(is) {
-    is >> status;
+  explicit EmptyMessage(const Message& msg) : Message(msg) {}
+};
+
+template<MessageType T> struct StatusMessage : Message {
+  static const MessageType TYPE = T;
+
+  StatusMessage(uint32_t sequence_number, uint32_t ack_sequence_number
+               , LeaderStatus s)
+    : Message(T, sequence_number, ack_sequence_number)
+  {
+    status = s;
   }
 
-  void to_stream(std::ostream& os) const override {
-    os << status;
+  explicit StatusMessage(const Message& msg) : Message(msg) {}
+};
+
+struct NumberMsg : Message {
+  static const MessageType TYPE = MessageType::number;
+
+  NumberMsg(uint32_t sequence_number, uint32_t ack_sequence_number
+           , uint64_t number)
+    : Message(TYPE, sequence_number, ack_sequence_number)
+  {
+    random_number = number;
   }
+
+  explicit NumberMsg(const Message& msg) : Message(msg) {}
 };
 
+using PingMsg    = EmptyMessage<MessageType::ping>;
+using StartMsg   = EmptyMessage<MessageType::start>;
+using Update1Msg = StatusMessage<MessageType::update1>;
+using Update2Msg = StatusMessage<MessageType::update2>;
+using ResultMsg  = StatusMessage<MessageType::result>;
+// The sender lost its last leader neighbor and is undecided again.
+using RepairMsg  = EmptyMessage<MessageType::repair>;
+
 //------------------------------------------------------------------------------
-struct Update2Msg : Message {
-  std::string label() const override { return "update2"; }
+// Reads one message in the text format.
+inline Message read_message(TextReader& r) {
+  static const size_t type_count = static_cast<size_t>(MessageType::repair) + 1;
 
-  LeaderStatus status;
+  size_t size;
+  const char* word = r.read_word(size);
 
-  Update2Msg(uint32_t sequence_number, uint32_t ack_sequence_number
-       , LeaderStatus status)
-    : Message(sequence_number, ack_sequence_number)
-    , status(status)
-  {}
+  for (size_t t = 0; t != type_count; ++t) {
+    auto type  = static_cast<MessageType>(t);
+    auto label = message_label(type);
 
-  Update2Msg(std::istream& is) : Message(is) {
-    is >> status;
-  }
+    if (size != strlen(label) || memcmp(word, label, size) != 0) continue;
+
+    uint32_t sequence_number     = r.read_uint();
+    uint32_t ack_sequence_number = r.read_uint();
+
+    Message msg(type, sequence_number, ack_sequence_number);
+
+    if (msg.has_number()) msg.random_number = priority_from_float(r.read_float());
+    if (msg.has_status()) msg.status        = r.read_status();
 
-  void to_stream(std::ostream& os) const override {
-    os << status;
+    return msg;
   }
-};
+
+  throw std::runtime_error("unrecognized message label");
+}
 
 //------------------------------------------------------------------------------
-struct ResultMsg : Message {
-  std::string label() const override { return "result"; }
+// Reads one message in the binary format.
+inline Message read_message(BinaryReader& r) {
+  uint8_t type = r.read_u8() & ~BINARY_MESSAGE_BIT;
 
-  LeaderStatus status;
+  if (type > static_cast<uint8_t>(MessageType::repair)) {
+    throw std::runtime_error("unrecognized message type");
+  }
 
-  ResultMsg(uint32_t sequence_number, uint32_t ack_sequence_number
-       , LeaderStatus status)
-    : Message(sequence_number, ack_sequence_number)
-    , status(status)
-  {}
+  uint32_t sequence_number     = r.read_u32();
+  uint32_t ack_sequence_number = r.read_u32();
 
-  ResultMsg(std::istream& is) : Message(is) {
-    is >> status;
-  }
+  Message msg(static_cast<MessageType>(type), sequence_number, ack_sequence_number);
+  msg.ack_bitmap = r.read_u32();
+
+  if (msg.has_number()) msg.random_number = r.read_u64();
+  if (msg.has_status()) msg.status        = r.read_status();
 
-  void to_stream(std::ostream& os) const override {
-    os << status;
+  return msg;
+}
+
+//------------------------------------------------------------------------------
+// Decodes every message of a datagram, in either wire format, and hands
+// each to 'handler' as a Message. A sender may coalesce several messages
+// into one datagram by simply concatenating them.
+template<typename Handler>
+void dispatch_datagram(const char* data, size_t size, const Handler& handler) {
+  if (!is_binary_message(data, size)) {
+    TextReader reader(data, size);
+    while (!reader.empty()) handler(read_message(reader));
+    return;
   }
-};
+
+  BinaryReader reader(data, size);
+  while (!reader.empty()) handler(read_message(reader));
+}
 
 //------------------------------------------------------------------------------
+// Same, with one handler per message type.
 template< typename PingHandler
         , typename StartHandler
         , typename NumberHandler
         , typename Update1Handler
         , typename Update2Handler
         , typename ResultHandler
+        , typename RepairHandler
         >
-void dispatch_message( std::istream& is
-                     , const PingHandler&    ping_handler
-                     , const StartHandler&   start_handler
-                     , const NumberHandler&  random_number_handler
-                     , const Update1Handler& update1_handler
-                     , const Update2Handler& update2_handler
-                     , const ResultHandler&  result_handler) {
-  using namespace std;
-
-  string label;
-  is >> label;
+void dispatch_datagram( const char* data, size_t size
+                      , const PingHandler&    ping_handler
+                      , const StartHandler&   start_handler
+                      , const NumberHandler&  random_number_handler
+                      , const Update1Handler& update1_handler
+                      , const Update2Handler& update2_handler
+                      , const ResultHandler&  result_handler
+                      , const RepairHandler&  repair_handler) {
+  dispatch_datagram(data, size, [&](const Message& msg) {
+      switch (msg.type) {
+        case MessageType::ping:    ping_handler(PingMsg(msg));             break;
+        case MessageType::start:   start_handler(StartMsg(msg));           break;
+        case MessageType::number:  random_number_handler(NumberMsg(msg));  break;
+        case MessageType::update1: update1_handler(Update1Msg(msg));       break;
+        case MessageType::update2: update2_handler(Update2Msg(msg));       break;
+        case MessageType::result:  result_handler(ResultMsg(msg));         break;
+        case MessageType::repair:  repair_handler(RepairMsg(msg));         break;
+      }
+      });
+}
 
-  if (label == "ping") {
-    ping_handler(PingMsg(is));
-  }
-  else if (label == "start") {
-    start_handler(StartMsg(is));
-  }
-  else if (label == "number") {
-    random_number_handler(NumberMsg(is));
-  }
-  else if (label == "update1") {
-    update1_handler(Update1Msg(is));
-  }
-  else if (label == "update2") {
-    update2_handler(Update2Msg(is));
-  }
-  else if (label == "result") {
-    result_handler(ResultMsg(is));
-  }
-  else {
-    throw runtime_error("unrecognized message label");
+//------------------------------------------------------------------------------
+inline void encode_message(WireFormat format, const Message& msg
+                          , std::string& out) {
+  if (format == WireFormat::text) {
+    TextWriter w(out);
+    w.write_word(msg.label());
+    w.write_space();
+    w.write_uint(msg.sequence_number);
+    w.write_space();
+    w.write_uint(msg.ack_sequence_number);
+    w.write_space();
+    if (msg.has_number()) w.write_float(priority_to_float(msg.random_number));
+    if (msg.has_status()) w.write_status(msg.status);
+    w.write_end();
+    return;
   }
+
+  BinaryWriter w(out);
+  w.write_u8(BINARY_MESSAGE_BIT | static_cast<uint8_t>(msg.type));
+  w.write_u32(msg.sequence_number);
+  w.write_u32(msg.ack_sequence_number);
+  w.write_u32(msg.ack_bitmap);
+  if (msg.has_number()) w.write_u64(msg.random_number);
+  if (msg.has_status()) w.write_status(msg.status);
 }
 
 //------------------------------------------------------------------------------
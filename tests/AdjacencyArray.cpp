@@ -0,0 +1,50 @@
+#include <algorithm>
+#include <cassert>
+#include "AdjacencyArray.h"
+
+using namespace std;
+using Vertex = AdjacencyArray::Vertex;
+
+//------------------------------------------------------------------------------
+AdjacencyArray::AdjacencyArray(size_t vertex_count, const vector<Edge>& edges)
+  : offsets(vertex_count + 1, 0)
+{
+  // Counting sort of both directions of every edge by source.
+  for (const auto& e : edges) {
+    assert(e.first < vertex_count && e.second < vertex_count);
+    if (e.first == e.second) continue;
+    ++offsets[e.first + 1];
+    ++offsets[e.second + 1];
+  }
+
+  for (size_t v = 0; v < vertex_count; ++v) {
+    offsets[v+1] += offsets[v];
+  }
+
+  targets.resize(offsets.back());
+  vector<uint64_t> fill(offsets.begin(), offsets.end() - 1);
+
+  for (const auto& e : edges) {
+    if (e.first == e.second) continue;
+    targets[fill[e.first]++]  = e.second;
+    targets[fill[e.second]++] = e.first;
+  }
+
+  // Sort each row and squeeze out duplicates in place.
+  uint64_t out = 0;
+
+  for (size_t v = 0; v < vertex_count; ++v) {
+    auto first = targets.begin() + offsets[v];
+    auto last  = targets.begin() + offsets[v+1];
+
+    sort(first, last);
+    last = unique(first, last);
+
+    offsets[v] = out;
+    out = copy(first, last, targets.begin() + out) - targets.begin();
+  }
+
+  offsets[vertex_count] = out;
+  targets.resize(out);
+  targets.shrink_to_fit();
+}
@@ -0,0 +1,34 @@
+#ifndef __ADJACENCY_ARRAY_H__
+#define __ADJACENCY_ARRAY_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Undirected graph over dense vertex indices. The neighbors of v are
+// targets[offsets[v]] up to targets[offsets[v+1]], sorted and without
+// duplicates.
+struct AdjacencyArray {
+  using Vertex = uint32_t;
+  using Edge   = std::pair<Vertex, Vertex>;
+
+  std::vector<uint64_t> offsets;
+  std::vector<Vertex>   targets;
+
+  AdjacencyArray() : offsets(1, 0) {}
+
+  // Every edge is added in both directions. Self loops and
+  // duplicates are dropped.
+  AdjacencyArray(size_t vertex_count, const std::vector<Edge>& edges);
+
+  size_t vertex_count() const { return offsets.size() - 1; }
+  size_t edge_count()   const { return targets.size() / 2; }
+
+  size_t degree(Vertex v) const { return offsets[v+1] - offsets[v]; }
+
+  const Vertex* begin(Vertex v) const { return targets.data() + offsets[v]; }
+  const Vertex* end(Vertex v)   const { return targets.data() + offsets[v+1]; }
+};
+
+#endif // ifndef __ADJACENCY_ARRAY_H__
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "Components.h"
+
+using namespace std;
+using Vertex  = Components::Vertex;
+using Parents = vector<atomic<Vertex>>;
+
+// Not worth a thread below this many vertices.
+static const size_t MIN_VERTICES_PER_THREAD = 1 << 16;
+
+//------------------------------------------------------------------------------
+static Vertex find_root(Parents& parent, Vertex v) {
+  while (true) {
+    Vertex p = parent[v].load(memory_order_relaxed);
+    if (p == v) return v;
+
+    // Path halving, losing the race only costs a step.
+    Vertex gp = parent[p].load(memory_order_relaxed);
+    parent[v].compare_exchange_weak(p, gp, memory_order_relaxed);
+    v = gp;
+  }
+}
+
+//------------------------------------------------------------------------------
+// Roots only ever get hooked under smaller roots, so the parent chains
+// can't form a cycle and every root ends up the smallest vertex of its
+// component.
+static void unite(Parents& parent, Vertex u, Vertex v) {
+  while (true) {
+    u = find_root(parent, u);
+    v = find_root(parent, v);
+
+    if (u == v) return;
+    if (u > v) swap(u, v);
+
+    Vertex expected = v;
+    if (parent[v].compare_exchange_strong(expected, u)) return;
+  }
+}
+
+//------------------------------------------------------------------------------
+template<class F>
+static void parallel_for(size_t n, size_t thread_count, const F& f) {
+  if (thread_count <= 1) {
+    f(0, n);
+    return;
+  }
+
+  vector<thread> threads;
+  size_t chunk = (n + thread_count - 1) / thread_count;
+
+  for (size_t t = 1; t < thread_count; ++t) {
+    size_t lo = min(n, t * chunk), hi = min(n, lo + chunk);
+    threads.emplace_back([&f, lo, hi]() { f(lo, hi); });
+  }
+
+  f(0, min(n, chunk));
+
+  for (auto& t : threads) t.join();
+}
+
+//------------------------------------------------------------------------------
+Components connected_components(const AdjacencyArray& g, size_t thread_count) {
+  size_t n = g.vertex_count();
+
+  if (thread_count == 0) thread_count = thread::hardware_concurrency();
+  thread_count = max<size_t>(1, min(thread_count, n / MIN_VERTICES_PER_THREAD));
+
+  Parents parent(n);
+
+  parallel_for(n, thread_count, [&](size_t lo, size_t hi) {
+      for (size_t v = lo; v < hi; ++v) {
+        parent[v].store(v, memory_order_relaxed);
+      }
+      });
+
+  // The joins of parallel_for are what publishes the stores to the
+  // next pass, within a pass relaxed CASes are enough.
+  parallel_for(n, thread_count, [&](size_t lo, size_t hi) {
+      for (Vertex v = lo; v < hi; ++v) {
+        for (auto u = g.begin(v); u != g.end(v); ++u) {
+          if (*u < v) unite(parent, v, *u);
+        }
+      }
+      });
+
+  Components result;
+  result.label.resize(n);
+
+  parallel_for(n, thread_count, [&](size_t lo, size_t hi) {
+      for (Vertex v = lo; v < hi; ++v) {
+        result.label[v] = find_root(parent, v);
+      }
+      });
+
+  // Roots are the smallest vertex of their component, so a root is
+  // always numbered before any other vertex refers to it.
+  result.offsets.push_back(0);
+
+  for (Vertex v = 0; v < n; ++v) {
+    if (result.label[v] == v) {
+      result.label[v] = result.offsets.size() - 1;
+      result.offsets.push_back(0);
+    }
+    else {
+      result.label[v] = result.label[result.label[v]];
+    }
+    ++result.offsets[result.label[v] + 1];
+  }
+
+  for (size_t c = 1; c < result.offsets.size(); ++c) {
+    result.offsets[c] += result.offsets[c-1];
+  }
+
+  result.members.resize(n);
+  vector<uint64_t> fill(result.offsets.begin(), result.offsets.end() - 1);
+
+  for (Vertex v = 0; v < n; ++v) {
+    result.members[fill[result.label[v]]++] = v;
+  }
+
+  return result;
+}
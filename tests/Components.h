@@ -0,0 +1,28 @@
+#ifndef __COMPONENTS_H__
+#define __COMPONENTS_H__
+
+#include <vector>
+#include "AdjacencyArray.h"
+
+// Connected components of an AdjacencyArray, numbered in the order of
+// their smallest vertex. The vertices of component c are members[offsets[c]]
+// up to members[offsets[c+1]], in increasing order.
+struct Components {
+  using Vertex = AdjacencyArray::Vertex;
+
+  std::vector<Vertex>   label; // Indexed by vertex
+  std::vector<uint64_t> offsets;
+  std::vector<Vertex>   members;
+
+  size_t count() const { return offsets.size() - 1; }
+  size_t size(Vertex c) const { return offsets[c+1] - offsets[c]; }
+
+  const Vertex* begin(Vertex c) const { return members.data() + offsets[c]; }
+  const Vertex* end(Vertex c)   const { return members.data() + offsets[c+1]; }
+};
+
+// Lock free union-find over the edges, split between threads. Zero threads
+// means one per core, small graphs are done on the calling thread alone.
+Components connected_components(const AdjacencyArray&, size_t thread_count = 0);
+
+#endif // ifndef __COMPONENTS_H__
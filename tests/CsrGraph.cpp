@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <cassert>
+#include "CsrGraph.h"
+#include "SequentialMIS.h"
+
+using namespace std;
+using Vertex = CsrGraph::Vertex;
+using Edge   = CsrGraph::Edge;
+
+//------------------------------------------------------------------------------
+CsrGraph::CsrGraph(const Graph& g) {
+  ids.reserve(g.nodes.size());
+  status.reserve(g.nodes.size());
+
+  // Set order is ID order already.
+  for (const auto& node : g.nodes) {
+    ids.push_back(node.id);
+    status.push_back(node.leader_status);
+  }
+
+  vector<Edge> edges;
+
+  Vertex v = 0;
+  for (const auto& node : g.nodes) {
+    for (auto neighbor : node.neighbors) {
+      Vertex u = vertex(neighbor);
+      if (u != size()) edges.emplace_back(v, u);
+    }
+    ++v;
+  }
+
+  adjacency = AdjacencyArray(size(), edges);
+}
+
+//------------------------------------------------------------------------------
+CsrGraph::CsrGraph( vector<ID> ids_
+                  , vector<LeaderStatus> status_
+                  , const vector<Edge>& edges)
+  : adjacency(ids_.size(), edges)
+  , ids(move(ids_))
+  , status(move(status_))
+{
+  assert(is_sorted(ids.begin(), ids.end()));
+  assert(ids.size() == status.size());
+}
+
+//------------------------------------------------------------------------------
+Vertex CsrGraph::vertex(ID id) const {
+  auto i = lower_bound(ids.begin(), ids.end(), id);
+  if (i == ids.end() || *i != id) return size();
+  return i - ids.begin();
+}
+
+//------------------------------------------------------------------------------
+bool CsrGraph::is_MIS() const {
+  return is_mis(adjacency, status);
+}
+
+//------------------------------------------------------------------------------
+vector<CsrGraph> CsrGraph::connected_subgraphs() const {
+  auto components = this->components();
+
+  // Members are in increasing order, so IDs stay sorted.
+  vector<Vertex> local(size());
+
+  for (Vertex c = 0; c < components.count(); ++c) {
+    Vertex i = 0;
+    for (auto v = components.begin(c); v != components.end(c); ++v) {
+      local[*v] = i++;
+    }
+  }
+
+  vector<CsrGraph> result;
+  result.reserve(components.count());
+
+  for (Vertex c = 0; c < components.count(); ++c) {
+    vector<ID>           sub_ids;
+    vector<LeaderStatus> sub_status;
+    vector<Edge>         sub_edges;
+
+    for (auto v = components.begin(c); v != components.end(c); ++v) {
+      sub_ids.push_back(ids[*v]);
+      sub_status.push_back(status[*v]);
+
+      for (auto u = adjacency.begin(*v); u != adjacency.end(*v); ++u) {
+        if (*u > *v) sub_edges.emplace_back(local[*v], local[*u]);
+      }
+    }
+
+    result.emplace_back(move(sub_ids), move(sub_status), sub_edges);
+  }
+
+  return result;
+}
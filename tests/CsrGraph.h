@@ -0,0 +1,45 @@
+#ifndef __CSR_GRAPH_H__
+#define __CSR_GRAPH_H__
+
+#include <vector>
+#include "AdjacencyArray.h"
+#include "Components.h"
+#include "Graph.h"
+#include "../ID.h"
+#include "../LeaderStatus.h"
+
+// Same as Graph, but laid out flat for networks too big to verify
+// through sets. Vertices are numbered in ID order.
+struct CsrGraph {
+  using Vertex = AdjacencyArray::Vertex;
+  using Edge   = AdjacencyArray::Edge;
+
+  AdjacencyArray            adjacency;
+  std::vector<ID>           ids;    // Sorted
+  std::vector<LeaderStatus> status;
+
+  CsrGraph() {}
+
+  // Neighbors which aren't nodes of the graph are left out.
+  explicit CsrGraph(const Graph&);
+
+  // 'ids' must be sorted.
+  CsrGraph( std::vector<ID> ids
+          , std::vector<LeaderStatus> status
+          , const std::vector<Edge>& edges);
+
+  size_t size() const { return ids.size(); }
+  bool empty() const { return ids.empty(); }
+
+  // Returns size() for an unknown ID.
+  Vertex vertex(ID) const;
+
+  bool is_MIS() const;
+
+  Components components() const { return connected_components(adjacency); }
+
+  // Deep copies, prefer components() where labels do.
+  std::vector<CsrGraph> connected_subgraphs() const;
+};
+
+#endif // ifndef __CSR_GRAPH_H__
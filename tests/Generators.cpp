@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include "Components.h"
+#include "Generators.h"
+#include "../Philox.h"
+
+using namespace std;
+using Vertex = AdjacencyArray::Vertex;
+using Edge   = AdjacencyArray::Edge;
+using Edges  = vector<Edge>;
+
+namespace {
+
+// Units of work, fixed so that the output doesn't depend on how many
+// threads share them.
+const size_t VERTICES_PER_BLOCK = 1 << 12;
+const size_t EDGES_PER_BLOCK    = 1 << 16;
+
+// Random numbers of stream 'stream' under 'seed', drawn by counting.
+class Stream {
+public:
+  Stream(uint64_t seed, uint64_t stream)
+    : _key(Philox::make_key(seed)), _stream(stream), _counter(0), _used(4) {}
+
+  uint32_t next32() {
+    if (_used == 4) {
+      _block = Philox::generate({{ uint32_t(_counter), uint32_t(_counter >> 32)
+                                 , uint32_t(_stream),  uint32_t(_stream >> 32) }}
+                               , _key);
+      ++_counter;
+      _used = 0;
+    }
+    return _block[_used++];
+  }
+
+  uint64_t next64() { return uint64_t(next32()) << 32 | next32(); }
+
+  // In [0, 1).
+  double uniform() { return (next64() >> 11) * (1.0 / (uint64_t(1) << 53)); }
+
+  // In [0, n), the modulo bias is far below anything a graph shows.
+  uint64_t below(uint64_t n) { return next64() % n; }
+
+private:
+  Philox::Key     _key;
+  uint64_t        _stream;
+  uint64_t        _counter;
+  unsigned        _used;
+  Philox::Counter _block;
+};
+
+// Streams of different generators given the same seed stay unrelated.
+enum Purpose : uint64_t {
+  gnp_stream       = 1ull << 56,
+  rmat_stream      = 2ull << 56,
+  geometric_stream = 3ull << 56,
+  ba_stream        = 4ull << 56,
+  connect_stream   = 5ull << 56,
+};
+
+size_t threads_for(size_t thread_count, size_t block_count) {
+  if (thread_count == 0) thread_count = thread::hardware_concurrency();
+  return max<size_t>(1, min(thread_count, block_count));
+}
+
+// Runs f(block, edges) for every block, then concatenates the edges
+// in block order.
+template<class F>
+Edges generate_blocks(size_t block_count, size_t thread_count, const F& f) {
+  vector<Edges> out(block_count);
+  atomic<size_t> next(0);
+
+  auto work = [&]() {
+    for (size_t b; (b = next.fetch_add(1)) < block_count;) f(b, out[b]);
+  };
+
+  vector<thread> threads;
+  for (size_t t = 1; t < threads_for(thread_count, block_count); ++t) {
+    threads.emplace_back(work);
+  }
+
+  work();
+  for (auto& t : threads) t.join();
+
+  size_t total = 0;
+  for (const auto& es : out) total += es.size();
+
+  Edges result;
+  result.reserve(total);
+
+  for (auto& es : out) {
+    result.insert(result.end(), es.begin(), es.end());
+    Edges().swap(es);
+  }
+
+  return result;
+}
+
+void check_vertex_count(size_t n) {
+  if (n >= numeric_limits<Vertex>::max()) throw runtime_error("Too many vertices");
+}
+
+Topology make_topology( size_t n, Edges& edges, uint64_t seed
+                      , bool connected, size_t thread_count) {
+  Topology result;
+  result.adjacency = AdjacencyArray(n, edges);
+
+  if (!connected) return result;
+
+  auto components = connected_components(result.adjacency, thread_count);
+  if (components.count() <= 1) return result;
+
+  Stream random(seed, connect_stream);
+
+  // Members of components 0..c-1 come first in 'members'.
+  for (Vertex c = 1; c < components.count(); ++c) {
+    auto v = components.begin(c)[random.below(components.size(c))];
+    auto u = components.members[random.below(components.offsets[c])];
+    edges.emplace_back(v, u);
+  }
+
+  result.adjacency = AdjacencyArray(n, edges);
+  return result;
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+// Pairs (v, w) with w < v are numbered row by row. A block of rows skips
+// through its own range of pairs, which is exact as the gaps between
+// drawn pairs are memoryless.
+Topology gnp_graph( size_t n, double p, uint64_t seed
+                  , bool connected, size_t thread_count) {
+  check_vertex_count(n);
+
+  size_t blocks = (n + VERTICES_PER_BLOCK - 1) / VERTICES_PER_BLOCK;
+  double log_q  = log1p(-min(p, 1.0));
+
+  auto edges = generate_blocks(blocks, thread_count, [&](size_t b, Edges& out) {
+      if (p <= 0) return;
+
+      Stream random(seed, gnp_stream | b);
+
+      uint64_t v  = b * VERTICES_PER_BLOCK;
+      uint64_t hi = min(n, v + VERTICES_PER_BLOCK);
+      int64_t  w  = -1;
+
+      while (v < hi) {
+        double skip = p >= 1 ? 0 : floor(log1p(-random.uniform()) / log_q);
+
+        // Skips past the block's last pair end it, huge ones
+        // wouldn't even convert.
+        if (skip > double(hi * hi)) break;
+
+        w += 1 + int64_t(skip);
+        while (v < hi && w >= int64_t(v)) { w -= v; ++v; }
+
+        if (v < hi) out.emplace_back(v, w);
+      }
+      });
+
+  return make_topology(n, edges, seed, connected, thread_count);
+}
+
+//------------------------------------------------------------------------------
+// Every edge has a stream of its own, the recursion takes one 32 bit
+// number per level to pick a quadrant.
+Topology rmat_graph( size_t n, size_t edge_count, uint64_t seed
+                   , bool connected, size_t thread_count) {
+  check_vertex_count(n);
+  if (n == 0) return Topology();
+
+  const double a = 0.57, b = 0.19, c = 0.19;
+
+  unsigned scale = 0;
+  while ((uint64_t(1) << scale) < n) ++scale;
+
+  size_t blocks = (edge_count + EDGES_PER_BLOCK - 1) / EDGES_PER_BLOCK;
+
+  auto edges = generate_blocks(blocks, thread_count, [&](size_t block, Edges& out) {
+      uint64_t first = block * EDGES_PER_BLOCK;
+      uint64_t last  = min<uint64_t>(edge_count, first + EDGES_PER_BLOCK);
+
+      out.reserve(last - first);
+
+      for (uint64_t e = first; e != last; ++e) {
+        Stream random(seed, rmat_stream | e);
+
+        while (true) {
+          uint64_t u = 0, v = 0;
+
+          for (unsigned level = 0; level < scale; ++level) {
+            double r = random.next32() * (1.0 / 4294967296.0);
+            u = u << 1 | (r >= a + b);
+            v = v << 1 | ((r >= a && r < a + b) || r >= a + b + c);
+          }
+
+          if (u < n && v < n) {
+            out.emplace_back(u, v);
+            break;
+          }
+        }
+      }
+      });
+
+  return make_topology(n, edges, seed, connected, thread_count);
+}
+
+//------------------------------------------------------------------------------
+// Points are bucketed into cells at least 'radius' wide, so a point
+// only needs to look at its own cell and the eight around it.
+Topology geometric_graph( size_t n, double radius, uint64_t seed
+                        , bool connected, size_t thread_count) {
+  check_vertex_count(n);
+
+  vector<double> x(n), y(n);
+
+  size_t blocks = (n + VERTICES_PER_BLOCK - 1) / VERTICES_PER_BLOCK;
+
+  generate_blocks(blocks, thread_count, [&](size_t b, Edges&) {
+      Stream random(seed, geometric_stream | b);
+      for (size_t v = b * VERTICES_PER_BLOCK; v < min(n, (b + 1) * VERTICES_PER_BLOCK); ++v) {
+        x[v] = random.uniform();
+        y[v] = random.uniform();
+      }
+      });
+
+  // No more cells than points, a tiny radius would otherwise
+  // ask for a huge empty grid.
+  double cells = radius > 0 ? min(1 / radius, ceil(sqrt(double(n)))) : 1;
+  size_t g     = max<size_t>(1, size_t(cells));
+
+  auto cell_of = [&](Vertex v) {
+    size_t cx = min(g - 1, size_t(x[v] * g));
+    size_t cy = min(g - 1, size_t(y[v] * g));
+    return cy * g + cx;
+  };
+
+  vector<uint64_t> cell_start(g * g + 1, 0);
+  for (Vertex v = 0; v < n; ++v) ++cell_start[cell_of(v) + 1];
+  for (size_t i = 0; i < g * g; ++i) cell_start[i + 1] += cell_start[i];
+
+  vector<Vertex>   cell_points(n);
+  vector<uint64_t> fill(cell_start.begin(), cell_start.end() - 1);
+  for (Vertex v = 0; v < n; ++v) cell_points[fill[cell_of(v)]++] = v;
+
+  double r2 = radius * radius;
+
+  auto edges = generate_blocks(blocks, thread_count, [&](size_t b, Edges& out) {
+      if (radius <= 0) return;
+
+      for (size_t v = b * VERTICES_PER_BLOCK; v < min(n, (b + 1) * VERTICES_PER_BLOCK); ++v) {
+        auto cell = cell_of(v);
+        int64_t cx = cell % g, cy = cell / g;
+
+        for (int64_t ny = max<int64_t>(0, cy - 1); ny <= min<int64_t>(g - 1, cy + 1); ++ny) {
+          for (int64_t nx = max<int64_t>(0, cx - 1); nx <= min<int64_t>(g - 1, cx + 1); ++nx) {
+            auto i = ny * g + nx;
+
+            for (auto p = cell_start[i]; p != cell_start[i + 1]; ++p) {
+              Vertex u = cell_points[p];
+              if (u <= v) continue;
+
+              double dx = x[u] - x[v], dy = y[u] - y[v];
+              if (dx * dx + dy * dy <= r2) out.emplace_back(v, u);
+            }
+          }
+        }
+      }
+      });
+
+  return make_topology(n, edges, seed, connected, thread_count);
+}
+
+//------------------------------------------------------------------------------
+Topology grid_graph(size_t width, size_t height, bool torus) {
+  size_t n = width * height;
+  check_vertex_count(n);
+
+  Edges edges;
+  edges.reserve(2 * n);
+
+  for (size_t y = 0; y < height; ++y) {
+    for (size_t x = 0; x < width; ++x) {
+      Vertex v = y * width + x;
+
+      if (x + 1 < width)      edges.emplace_back(v, v + 1);
+      else if (torus)         edges.emplace_back(v, y * width);
+
+      if (y + 1 < height)     edges.emplace_back(v, v + width);
+      else if (torus)         edges.emplace_back(v, x);
+    }
+  }
+
+  Topology result;
+  result.adjacency = AdjacencyArray(n, edges);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// Picking a uniform entry of the list of every edge end so far is
+// picking a vertex with probability proportional to its degree.
+Topology barabasi_albert_graph(size_t n, size_t m, uint64_t seed) {
+  check_vertex_count(n);
+
+  Stream random(seed, ba_stream);
+
+  Edges edges;
+  edges.reserve(n * m);
+
+  vector<Vertex> ends;
+  ends.reserve(2 * n * m);
+
+  for (Vertex v = 1; v < n; ++v) {
+    // Ends added for this vertex aren't picked from until it is done.
+    size_t known = ends.size();
+
+    for (size_t i = 0; i < min<size_t>(m, v); ++i) {
+      Vertex u = known == 0 ? 0 : ends[random.below(known)];
+      edges.emplace_back(v, u);
+      ends.push_back(v);
+      ends.push_back(u);
+    }
+  }
+
+  Topology result;
+  result.adjacency = AdjacencyArray(n, edges);
+  return result;
+}
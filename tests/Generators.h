@@ -0,0 +1,46 @@
+#ifndef __GENERATORS_H__
+#define __GENERATORS_H__
+
+#include <cstddef>
+#include <cstdint>
+#include "GraphFile.h"
+
+// Random topologies, built straight into CSR for Network::add_topology.
+//
+// Each is a pure function of its arguments, whatever the thread count:
+// random numbers come from Philox streams keyed by the seed and counted
+// per vertex, per edge or per block of work, and blocks are put together
+// in order. Zero threads means one per core.
+//
+// With 'connected' set, every component but the first gets one edge to
+// a random vertex of the components before it, so the fix up adds
+// count - 1 edges and no long chains.
+
+// Erdős–Rényi G(n, p), sampled by geometric skips over the vertex pairs,
+// so the cost is linear in the edges drawn rather than in n².
+Topology gnp_graph( size_t n, double p, uint64_t seed
+                  , bool connected = false, size_t thread_count = 0);
+
+// R-MAT with the Graph500 probabilities (0.57, 0.19, 0.19, 0.05): skewed,
+// power law like degrees with a few hubs. Edges falling outside n when
+// it is not a power of two are drawn again, duplicates and self loops
+// are dropped, so there may be somewhat fewer than 'edge_count'.
+Topology rmat_graph( size_t n, size_t edge_count, uint64_t seed
+                   , bool connected = false, size_t thread_count = 0);
+
+// Points uniform in the unit square, joined when closer than 'radius'.
+// Expected degree is about n π radius², diameter about 1 / radius.
+Topology geometric_graph( size_t n, double radius, uint64_t seed
+                        , bool connected = false, size_t thread_count = 0);
+
+// Vertex x + y * width is joined to its right and lower neighbors, a
+// torus wraps both ways around. Always connected.
+Topology grid_graph(size_t width, size_t height, bool torus = false);
+
+// Barabási–Albert preferential attachment, each new vertex joining 'm'
+// earlier ones (fewer when it draws the same one twice). Connected by
+// construction. Every step depends on the previous ones, so this one
+// runs on a single thread, still in O(n m).
+Topology barabasi_albert_graph(size_t n, size_t m, uint64_t seed);
+
+#endif // ifndef __GENERATORS_H__
@@ -1,27 +1,12 @@
 
 #include "Graph.h"
-#include "../log.h"
+#include "CsrGraph.h"
+#include "log.h"
 
 using namespace std;
 using Node  = Graph::Node;
 using Nodes = Graph::Nodes;
 
-static
-void extract_connected_subgraph(Graph& g, Nodes::iterator i, Graph& target) {
-  Node n = *i;
-  g.nodes.erase(i);
-  target.nodes.insert(n);
-
-  for (ID neighbor_id : n.neighbors) {
-    auto neighbor_i = g.nodes.find(Node(neighbor_id));
-
-    // Already extracted
-    if (neighbor_i == g.nodes.end()) continue;
-
-    extract_connected_subgraph(g, neighbor_i, target);
-  }
-}
-
 void Graph::connect(ID i, ID j) {
   auto ni = nodes.find(i);
   auto nj = nodes.find(j);
@@ -31,14 +16,16 @@ void Graph::connect(ID i, ID j) {
 }
 
 vector<Graph> Graph::connected_subgraphs() const {
-  vector<Graph> result;
+  CsrGraph csr(*this);
+  auto components = csr.components();
 
-  Graph g = *this;
+  vector<Graph> result(components.count());
 
-  while (!g.nodes.empty()) {
-    Graph connected;
-    extract_connected_subgraph(g, g.nodes.begin(), connected);
-    result.push_back(connected);
+  // Set order is vertex order, so every insert goes to the end.
+  CsrGraph::Vertex v = 0;
+  for (const auto& node : nodes) {
+    auto& target = result[components.label[v++]].nodes;
+    target.insert(target.end(), node);
   }
 
   return result;
@@ -0,0 +1,389 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "GraphFile.h"
+
+using namespace std;
+using Vertex = AdjacencyArray::Vertex;
+using Edge   = AdjacencyArray::Edge;
+
+namespace {
+
+// Read only view of a whole file.
+class MappedFile {
+public:
+  explicit MappedFile(const string& path) : _data(nullptr), _size(0) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw runtime_error("Can't open " + path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw runtime_error("Can't stat " + path);
+    }
+
+    _size = st.st_size;
+
+    // Zero length mappings fail, an empty file is just empty.
+    if (_size) {
+      void* p = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+      if (p == MAP_FAILED) {
+        ::close(fd);
+        throw runtime_error("Can't map " + path);
+      }
+
+      madvise(p, _size, MADV_SEQUENTIAL);
+      _data = static_cast<const char*>(p);
+    }
+
+    ::close(fd);
+  }
+
+  MappedFile(const MappedFile&)                  = delete;
+  const MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+    if (_data) munmap(const_cast<char*>(_data), _size);
+  }
+
+  const char* begin() const { return _data; }
+  const char* end()   const { return _data + _size; }
+  size_t      size()  const { return _size; }
+
+private:
+  const char* _data;
+  size_t      _size;
+};
+
+// Walks a text file line by line without copying it.
+class TextCursor {
+public:
+  TextCursor(const string& path, const MappedFile& file)
+    : _path(path), _p(file.begin()), _end(file.end()), _line(1) {}
+
+  bool at_end() const { return _p == _end; }
+
+  bool at_line_end() {
+    skip_blanks();
+    return _p == _end || *_p == '\n';
+  }
+
+  bool at_comment(const char* starts) {
+    skip_blanks();
+    return _p != _end && strchr(starts, *_p);
+  }
+
+  void next_line() {
+    while (_p != _end && *_p != '\n') ++_p;
+    if (_p != _end) { ++_p; ++_line; }
+  }
+
+  uint64_t number() {
+    skip_blanks();
+
+    if (_p == _end || !is_digit(*_p)) fail("number expected");
+
+    uint64_t n = 0;
+
+    for (; _p != _end && is_digit(*_p); ++_p) {
+      if (n > (numeric_limits<uint64_t>::max() - 9) / 10) fail("number too big");
+      n = n * 10 + (*_p - '0');
+    }
+
+    return n;
+  }
+
+  [[noreturn]] void fail(const string& what) const {
+    throw runtime_error(_path + ":" + to_string(_line) + ": " + what);
+  }
+
+private:
+  static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+  void skip_blanks() {
+    while (_p != _end && (*_p == ' ' || *_p == '\t' || *_p == '\r')) ++_p;
+  }
+
+private:
+  const string& _path;
+  const char*   _p;
+  const char*   _end;
+  size_t        _line;
+};
+
+struct Header {
+  char     magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t vertex_count;
+  uint64_t target_count;
+};
+
+const char     MAGIC[8]   = { 'F', 'M', 'G', 'R', 'A', 'P', 'H', '1' };
+const uint32_t VERSION    = 1;
+const uint32_t HAS_STATUS = 1 << 0;
+
+void check_vertex_count(const string& path, uint64_t n) {
+  if (n >= numeric_limits<Vertex>::max()) {
+    throw runtime_error(path + ": too many vertices");
+  }
+}
+
+bool ends_with(const string& s, const string& suffix) {
+  return s.size() >= suffix.size()
+      && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+Topology load_edge_list(const string& path) {
+  MappedFile file(path);
+  TextCursor c(path, file);
+
+  vector<pair<uint64_t, uint64_t>> pairs;
+
+  for (; !c.at_end(); c.next_line()) {
+    if (c.at_line_end() || c.at_comment("#%")) continue;
+    auto u = c.number();
+    auto v = c.number();
+    pairs.emplace_back(u, v);
+  }
+
+  vector<uint64_t> labels;
+  labels.reserve(pairs.size() * 2);
+
+  for (const auto& p : pairs) {
+    labels.push_back(p.first);
+    labels.push_back(p.second);
+  }
+
+  sort(labels.begin(), labels.end());
+  labels.erase(unique(labels.begin(), labels.end()), labels.end());
+  check_vertex_count(path, labels.size());
+
+  // Files numbered 0..n-1 already need no lookup.
+  bool dense = labels.empty() || labels.back() + 1 == labels.size();
+
+  auto vertex = [&](uint64_t label) -> Vertex {
+    if (dense) return label;
+    return lower_bound(labels.begin(), labels.end(), label) - labels.begin();
+  };
+
+  vector<Edge> edges;
+  edges.reserve(pairs.size());
+
+  for (const auto& p : pairs) {
+    edges.emplace_back(vertex(p.first), vertex(p.second));
+  }
+
+  Topology result;
+  result.adjacency = AdjacencyArray(labels.size(), edges);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+Topology load_metis(const string& path) {
+  MappedFile file(path);
+  TextCursor c(path, file);
+
+  auto skip_comments = [&]() {
+    while (!c.at_end() && c.at_comment("%")) c.next_line();
+  };
+
+  skip_comments();
+  if (c.at_end()) c.fail("header expected");
+
+  uint64_t n    = c.number();
+  uint64_t m    = c.number();
+  uint64_t fmt  = c.at_line_end() ? 0 : c.number();
+  uint64_t ncon = c.at_line_end() ? 1 : c.number();
+  c.next_line();
+
+  check_vertex_count(path, n);
+
+  bool has_edge_weights   = fmt % 10 == 1;
+  bool has_vertex_weights = fmt / 10 % 10 == 1;
+  bool has_vertex_sizes   = fmt / 100 % 10 == 1;
+
+  vector<Edge> edges;
+  edges.reserve(m * 2);
+
+  for (uint64_t v = 0; v < n; ++v) {
+    skip_comments();
+
+    // A last vertex without neighbors may have lost its empty line.
+    if (c.at_end() && v + 1 < n) c.fail("vertex lines missing");
+
+    if (has_vertex_sizes) c.number();
+    if (has_vertex_weights) {
+      for (uint64_t i = 0; i < ncon; ++i) c.number();
+    }
+
+    while (!c.at_line_end()) {
+      auto u = c.number();
+      if (u == 0 || u > n) c.fail("neighbor out of range");
+      if (has_edge_weights) c.number();
+      edges.emplace_back(v, u - 1);
+    }
+
+    c.next_line();
+  }
+
+  Topology result;
+  result.adjacency = AdjacencyArray(n, edges);
+
+  if (result.adjacency.edge_count() != m) {
+    throw runtime_error( path + ": header says " + to_string(m) + " edges, found "
+                       + to_string(result.adjacency.edge_count()));
+  }
+
+  return result;
+}
+
+//------------------------------------------------------------------------------
+Topology load_binary_topology(const string& path) {
+  MappedFile file(path);
+
+  Header header;
+
+  if (file.size() < sizeof(header)) throw runtime_error(path + ": not a graph file");
+  memcpy(&header, file.begin(), sizeof(header));
+
+  if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+    throw runtime_error(path + ": not a graph file");
+  }
+
+  if (header.version != VERSION) {
+    throw runtime_error(path + ": unsupported graph file version");
+  }
+
+  auto n = header.vertex_count;
+  auto t = header.target_count;
+
+  check_vertex_count(path, n);
+
+  bool has_status = header.flags & HAS_STATUS;
+
+  // Counts are checked against what's left of the file by division,
+  // a damaged header could make the products overflow.
+  size_t left = file.size() - sizeof(header);
+
+  if (n + 1 > left / sizeof(uint64_t)) throw runtime_error(path + ": truncated graph file");
+  left -= (n + 1) * sizeof(uint64_t);
+
+  if (t > left / sizeof(Vertex)) throw runtime_error(path + ": truncated graph file");
+  left -= t * sizeof(Vertex);
+
+  if (left != (has_status ? n : 0)) throw runtime_error(path + ": truncated graph file");
+
+  Topology result;
+  auto& a = result.adjacency;
+
+  const char* p = file.begin() + sizeof(header);
+
+  a.offsets.resize(n + 1);
+  memcpy(a.offsets.data(), p, (n + 1) * sizeof(uint64_t));
+  p += (n + 1) * sizeof(uint64_t);
+
+  a.targets.resize(t);
+  memcpy(a.targets.data(), p, t * sizeof(Vertex));
+  p += t * sizeof(Vertex);
+
+  // Checked so that a damaged file can't send anyone out of bounds.
+  if (a.offsets.front() != 0 || a.offsets.back() != t ||
+      !is_sorted(a.offsets.begin(), a.offsets.end())) {
+    throw runtime_error(path + ": bad offsets");
+  }
+
+  for (auto target : a.targets) {
+    if (target >= n) throw runtime_error(path + ": bad target");
+  }
+
+  // Everything else relies on rows being sorted without duplicates or
+  // self loops, and on each edge being there both ways.
+  for (Vertex v = 0; v < n; ++v) {
+    for (auto i = a.begin(v); i != a.end(v); ++i) {
+      if (*i == v || (i != a.begin(v) && *(i - 1) >= *i)) {
+        throw runtime_error(path + ": bad adjacency row");
+      }
+
+      if (!binary_search(a.begin(*i), a.end(*i), v)) {
+        throw runtime_error(path + ": asymmetric adjacency");
+      }
+    }
+  }
+
+  if (has_status) {
+    result.status.reserve(n);
+
+    for (uint64_t v = 0; v < n; ++v) {
+      auto s = uint8_t(p[v]);
+      if (s > uint8_t(LeaderStatus::leader)) throw runtime_error(path + ": bad status");
+      result.status.push_back(LeaderStatus(s));
+    }
+  }
+
+  return result;
+}
+
+//------------------------------------------------------------------------------
+Topology load_topology(const string& path) {
+  {
+    ifstream file(path, ios::binary);
+    if (!file) throw runtime_error("Can't open " + path);
+
+    char magic[sizeof(MAGIC)] = {};
+    file.read(magic, sizeof(magic));
+
+    if (memcmp(magic, MAGIC, sizeof(MAGIC)) == 0) {
+      return load_binary_topology(path);
+    }
+  }
+
+  if (ends_with(path, ".graph") || ends_with(path, ".metis")) {
+    return load_metis(path);
+  }
+
+  return load_edge_list(path);
+}
+
+//------------------------------------------------------------------------------
+void save_binary_topology(const string& path, const Topology& topology) {
+  const auto& a = topology.adjacency;
+  auto n = a.vertex_count();
+
+  if (!topology.status.empty() && topology.status.size() != n) {
+    throw runtime_error("Status count doesn't match the vertex count");
+  }
+
+  ofstream file(path, ios::binary | ios::trunc);
+  if (!file) throw runtime_error("Can't open " + path);
+
+  Header header;
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version      = VERSION;
+  header.flags        = topology.status.empty() ? 0 : HAS_STATUS;
+  header.vertex_count = n;
+  header.target_count = a.targets.size();
+
+  vector<uint8_t> status;
+  status.reserve(topology.status.size());
+  for (auto s : topology.status) status.push_back(uint8_t(s));
+
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write( reinterpret_cast<const char*>(a.offsets.data())
+            , a.offsets.size() * sizeof(uint64_t));
+  file.write( reinterpret_cast<const char*>(a.targets.data())
+            , a.targets.size() * sizeof(Vertex));
+  file.write(reinterpret_cast<const char*>(status.data()), status.size());
+
+  if (!file.flush()) throw runtime_error("Can't write " + path);
+}
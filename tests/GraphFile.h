@@ -0,0 +1,41 @@
+#ifndef __GRAPH_FILE_H__
+#define __GRAPH_FILE_H__
+
+#include <string>
+#include <vector>
+#include "AdjacencyArray.h"
+#include "../LeaderStatus.h"
+
+// Topologies on disk. Vertices are dense indices, the IDs of the nodes
+// built out of them are up to the network.
+struct Topology {
+  AdjacencyArray            adjacency;
+  std::vector<LeaderStatus> status; // One per vertex, or empty
+};
+
+// Files are mapped into memory rather than streamed. Errors, including
+// malformed input, throw runtime_error.
+
+// One "u v" pair per line, anything after it on the line is ignored and
+// lines starting with '#' or '%' are comments (SNAP edge lists load
+// as is). Labels are any non negative integers and get renumbered to
+// 0..n-1 in increasing order.
+Topology load_edge_list(const std::string& path);
+
+// The METIS graph format: a "n m [fmt [ncon]]" header then one line of
+// 1-based neighbors per vertex. Vertex sizes and weights as well as edge
+// weights are skipped.
+Topology load_metis(const std::string& path);
+
+// Our own format, see save_binary_topology.
+Topology load_binary_topology(const std::string& path);
+
+// Binary files are told by their magic, METIS files by a .graph or
+// .metis extension, anything else is taken for an edge list.
+Topology load_topology(const std::string& path);
+
+// A header, then the CSR offsets and targets, then the statuses if any,
+// all in native byte order. Loading it is a few copies.
+void save_binary_topology(const std::string& path, const Topology&);
+
+#endif // ifndef __GRAPH_FILE_H__
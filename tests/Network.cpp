@@ -1,11 +1,13 @@
+#include <cassert>
 #include <set>
+#include <algorithm>
 #include <iostream>
 #include <boost/random/random_device.hpp>
 #include "Random.h"
 #include "Network.h"
 #include "Graph.h"
 #include "WhenAll.h"
-#include "../log.h"
+#include "log.h"
 #include "../Node.h"
 #include "../Connection.h"
 
@@ -18,58 +20,250 @@ static unsigned int get_random_number(int max) {
 }
 
 Network::Network(asio::io_service& ios)
-  : _io_service(ios)
+  : _shards(1, &ios)
+  , _next_shard(0)
+  , _pool(nullptr)
+  , _hub(nullptr)
+  , _recovery(Node::Recovery::restart)
 {}
 
+Network::Network(IoServicePool& pool)
+  : _next_shard(0)
+  , _pool(&pool)
+  , _hub(nullptr)
+  , _recovery(Node::Recovery::restart)
+{
+  for (size_t i = 0; i < pool.size(); ++i) {
+    _shards.push_back(&pool[i]);
+  }
+}
+
+// Nodes go before the muxes and the hub their transports are
+// attached to.
+Network::~Network() {
+  for (auto n : _nodes) _node_pool.destroy(n);
+}
+
+void Network::use_udp_mux() {
+  if (!_muxes.empty()) return;
+
+  for (auto shard : _shards) {
+    _muxes.emplace_back(new UdpMux(*shard));
+  }
+}
+
+Node* Network::new_node() {
+  size_t shard = _next_shard++ % _shards.size();
+
+  if (_hub) {
+    auto t = new MemoryTransport(*_shards[shard], *_hub);
+    return _node_pool.create(unique_ptr<Transport>(t));
+  }
+
+  if (!_muxes.empty()) {
+    return _node_pool.create(unique_ptr<Transport>(new MuxTransport(*_muxes[shard])));
+  }
+
+  return _node_pool.create(*_shards[shard]);
+}
+
 void Network::add_nodes(size_t node_count) {
   for (size_t i = 0; i < node_count; ++i) {
-    _nodes.push_back(new Node(_io_service));
+    add_node();
   }
 }
 
 void Network::generate_connected(size_t node_count, float exp_neighbors) {
+  size_t first = size();
   add_nodes(node_count);
 
   if (node_count <= 1) return;
 
-  set<pair<size_t, size_t>> connections;
+  vector<AdjacencyArray::Edge> edges;
   auto& random = Random::instance();
 
   // Generate minimal connected graph
-  for (size_t i = 1; i < _nodes.size(); ++i) {
-    size_t j = random.generate_int(0, i - 1);
-
-    if (i < j) { connections.insert(make_pair(i,j)); }
-    else       { connections.insert(make_pair(j,i)); }
+  for (size_t i = 1; i < node_count; ++i) {
+    edges.emplace_back(random.generate_int(0, i - 1), i);
   }
 
   if (exp_neighbors > 0.1) {
     // Add few more connections for good measure
     float stop_probability = 1.0 / (exp_neighbors + 1);
 
-    for (size_t i = 0; i < _nodes.size(); ++i) {
+    for (size_t i = 0; i < node_count; ++i) {
       while (random.generate_float() >= stop_probability) {
         size_t j = i;
-        while (j == i) { j = get_random_number(_nodes.size()); }
-
-        if (i < j) { connections.insert(make_pair(i,j)); }
-        else       { connections.insert(make_pair(j,i)); }
+        while (j == i) { j = get_random_number(node_count); }
+        edges.emplace_back(i, j);
       }
     }
   }
 
-  for (auto c : connections) {
-    // Do it both ways so that we know right away who is connected
-    // to whom.
-    _nodes[c.first].connect(_nodes[c.second].local_endpoint());
-    _nodes[c.second].connect(_nodes[c.first].local_endpoint());
+  // Sorted and without duplicates, in the order a set of
+  // pairs would give.
+  AdjacencyArray adjacency(node_count, edges);
+
+  for (AdjacencyArray::Vertex v = 0; v < node_count; ++v) {
+    for (auto u = adjacency.begin(v); u != adjacency.end(v); ++u) {
+      if (*u < v) continue;
+      // Do it both ways so that we know right away who is connected
+      // to whom.
+      (*this)[first + v].connect((*this)[first + *u].id());
+      (*this)[first + *u].connect((*this)[first + v].id());
+    }
+  }
+}
+
+void Network::add_topology(const Topology& topology) {
+  const auto& a = topology.adjacency;
+  size_t first = size();
+
+  add_nodes(a.vertex_count());
+
+  for (AdjacencyArray::Vertex v = 0; v < a.vertex_count(); ++v) {
+    auto& node = (*this)[first + v];
+    for (auto u = a.begin(v); u != a.end(v); ++u) {
+      node.connect((*this)[first + *u].id());
+    }
   }
 }
 
+Network::Snapshot::Entry Network::read_node(const Node& node) {
+  Snapshot::Entry entry;
+  entry.id                     = node.id();
+  entry.status                 = node.leader_status();
+  entry.is_running             = node.is_running_mis();
+  entry.every_neighbor_decided = node.every_neighbor_decided();
+
+  entry.neighbors.reserve(node.size());
+  node.each_connection([&](const Connection& c) { entry.neighbors.push_back(c.id()); });
+
+  return entry;
+}
+
+Network::Snapshot Network::snapshot() const {
+  Snapshot result;
+  result.nodes.reserve(size());
+  for (const auto& node : *this) result.nodes.push_back(read_node(node));
+  return result;
+}
+
+void Network::async_snapshot(std::function<void(const Snapshot&)> f) {
+  if (_nodes.empty()) return f(Snapshot());
+
+  auto result = std::make_shared<Snapshot>();
+  result->nodes.resize(size());
+
+  // Each continuation is the last thing its shard does for the
+  // snapshot, so the one that completes it sees every entry.
+  WhenAll when_all([result, f]() { f(*result); });
+
+  // Reads dispatched to the calling thread's shard run right away,
+  // they mustn't complete the snapshot before the rest are out.
+  auto all_dispatched = when_all.make_continuation();
+
+  for (size_t i = 0; i < size(); ++i) {
+    auto& node         = *_nodes[i];
+    auto  continuation = when_all.make_continuation();
+
+    on_shard_of(node, [&node, result, i, continuation]() {
+        result->nodes[i] = read_node(node);
+        continuation();
+        });
+  }
+
+  all_dispatched();
+}
+
+CsrGraph Network::Snapshot::build_csr_graph() const {
+  vector<const Entry*> sorted;
+  sorted.reserve(nodes.size());
+  for (const auto& e : nodes) sorted.push_back(&e);
+
+  sort( sorted.begin(), sorted.end()
+      , [](const Entry* a, const Entry* b) { return a->id < b->id; });
+
+  vector<ID>           ids;
+  vector<LeaderStatus> status;
+
+  for (auto e : sorted) {
+    ids.push_back(e->id);
+    status.push_back(e->status);
+  }
+
+  vector<CsrGraph::Edge> edges;
+
+  for (CsrGraph::Vertex v = 0; v < sorted.size(); ++v) {
+    for (auto id : sorted[v]->neighbors) {
+      auto i = lower_bound(ids.begin(), ids.end(), id);
+      if (i == ids.end() || *i != id) continue;
+      edges.emplace_back(v, i - ids.begin());
+    }
+  }
+
+  return CsrGraph(std::move(ids), std::move(status), edges);
+}
+
+Topology Network::Snapshot::topology() const {
+  using Vertex = AdjacencyArray::Vertex;
+
+  vector<pair<ID, Vertex>> vertices;
+  vertices.reserve(nodes.size());
+
+  for (Vertex v = 0; v < nodes.size(); ++v) vertices.emplace_back(nodes[v].id, v);
+  sort(vertices.begin(), vertices.end());
+
+  Topology result;
+  vector<AdjacencyArray::Edge> edges;
+  result.status.reserve(nodes.size());
+
+  for (Vertex v = 0; v < nodes.size(); ++v) {
+    result.status.push_back(nodes[v].status);
+
+    for (auto id : nodes[v].neighbors) {
+      auto i = lower_bound( vertices.begin(), vertices.end()
+                          , make_pair(id, Vertex(0)));
+      if (i == vertices.end() || i->first != id) continue;
+      edges.emplace_back(v, i->second);
+    }
+  }
+
+  result.adjacency = AdjacencyArray(nodes.size(), edges);
+  return result;
+}
+
+bool Network::Snapshot::every_node_stopped() const {
+  for (const auto& e : nodes) {
+    if (e.is_running) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Network::Snapshot::every_node_decided() const {
+  for (const auto& e : nodes) {
+    if (e.status == LeaderStatus::undecided) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Network::Snapshot::every_neighbor_decided() const {
+  for (const auto& e : nodes) {
+    if (!e.every_neighbor_decided) {
+      return false;
+    }
+  }
+  return true;
+}
+
 Graph Network::build_graph() const {
   Graph result;
 
-  for (const auto& network_node : _nodes) {
+  for (const auto& network_node : *this) {
     auto pair = result.nodes.emplace( network_node.id()
                                     , network_node.leader_status());
     auto& graph_node = *pair.first;
@@ -82,24 +276,41 @@ Graph Network::build_graph() const {
   return result;
 }
 
+// Being an MIS is a local property, so checking the whole
+// network at once is the same as checking every component.
 bool Network::is_MIS() const {
-  vector<Graph> graphs = build_graph().connected_subgraphs();
+  return build_csr_graph().is_MIS();
+}
 
-  for (const auto& graph : graphs) {
-    if (!graph.is_MIS()) { return false; }
+void Network::shutdown() {
+  for (auto& n : *this) {
+    on_shard_of(n, [&n]() { n.shutdown(); });
   }
 
-  return true;
+  for (size_t i = 0; i < _muxes.size(); ++i) {
+    auto mux = _muxes[i].get();
+    _shards[i]->dispatch([mux]() { mux->close(); });
+  }
+
+  if (_pool) _pool->release();
 }
 
-void Network::shutdown() {
-  for (auto& n : _nodes) {
-    n.shutdown();
-  }
+size_t Network::memory_usage() const {
+  size_t result = _node_pool.memory_usage()
+                + _nodes.capacity() * sizeof(Node*);
+
+  for (const auto& node : *this) result += node.memory_usage();
+  return result;
+}
+
+Counters Network::counters() const {
+  Counters result;
+  for (const auto& node : *this) result += node.counters();
+  return result;
 }
 
 bool Network::every_node_stopped() const {
-  for (const auto& node : _nodes) {
+  for (const auto& node : *this) {
     if (node.is_running_mis()) {
       return false;
     }
@@ -108,7 +319,7 @@ bool Network::every_node_stopped() const {
 }
 
 bool Network::every_node_decided() const {
-  for (const auto& node : _nodes) {
+  for (const auto& node : *this) {
     if (node.leader_status() == LeaderStatus::undecided) {
       return false;
     }
@@ -117,7 +328,7 @@ bool Network::every_node_decided() const {
 }
 
 bool Network::every_neighbor_decided() const {
-  for (const auto& node : _nodes) {
+  for (const auto& node : *this) {
     if (!node.every_neighbor_decided()) {
       return false;
     }
@@ -126,9 +337,9 @@ bool Network::every_neighbor_decided() const {
 }
 
 std::ostream& operator<<(std::ostream& os, const Network& g) {
-  for (auto i = g._nodes.begin(); i != g._nodes.end(); ++i) {
+  for (auto i = g.begin(); i != g.end(); ++i) {
     os << *i;
-    if (i != --g._nodes.end()) {
+    if (i != --g.end()) {
       os << endl;
     }
   }
@@ -140,62 +351,100 @@ void Network::start_fast_mis(const std::function<void()>& handler) {
 
   _on_algorithm_completed = handler;
 
-  WhenAll when_all(handler);
+  // Nothing starts before the topology is read, each node on its
+  // own shard.
+  async_snapshot([this, handler](const Snapshot& snapshot) {
+      auto graph      = snapshot.build_csr_graph();
+      auto components = graph.components();
 
-  for (auto& node : _nodes) {
-    node.on_fast_mis_ended(when_all.make_continuation());
-  }
+      WhenAll when_all(handler);
 
-  vector<Graph> graphs = build_graph().connected_subgraphs();
+      for (auto& node : *this) {
+        auto continuation = when_all.make_continuation();
+        on_shard_of(node, [&node, continuation]() {
+            node.on_fast_mis_ended(continuation);
+            });
+      }
 
-  for (const auto& g : graphs) {
-    assert(!g.nodes.empty());
-    auto first_node_id = g.nodes.begin()->id;
-    auto first_node_i = find(first_node_id);
+      for (size_t c = 0; c < components.count(); ++c) {
+        assert(components.size(c) != 0);
+        auto first_node_id = graph.ids[*components.begin(c)];
+        auto first_node_p = find(first_node_id);
 
-    assert(first_node_i != _nodes.end());
-    first_node_i->start_fast_mis();
-  }
+        assert(first_node_p);
+        auto& first_node = *first_node_p;
+        on_shard_of(first_node, [&first_node]() { first_node.start_fast_mis(); });
+      }
+      });
 }
 
 void Network::start_fast_mis() {
   start_fast_mis(_on_algorithm_completed);
 }
 
-Network::Nodes::iterator Network::find(ID id) {
-  return find_if( _nodes.begin(), _nodes.end()
-                , [id](const Node& n) { return n.id() == id; });
+Node* Network::find(ID id) {
+  auto i = _index.find(id);
+  return i == _index.end() ? nullptr : i->second;
+}
+
+Node& Network::add_node() {
+  auto node = new_node();
+  node->set_random_seed(Random::instance().get_seed());
+  node->set_recovery(_recovery);
+  _nodes.push_back(node);
+  _index[node->id()] = node;
+  return *node;
+}
+
+template<class Pred> void Network::erase_nodes_if(const Pred& pred) {
+  auto i = remove_if(_nodes.begin(), _nodes.end(), [&](Node* n) {
+      if (!pred(*n)) return false;
+      _index.erase(n->id());
+      _node_pool.destroy(n);
+      return true;
+      });
+
+  _nodes.erase(i, _nodes.end());
 }
 
 void Network::add_random_node() {
-  _nodes.push_back(new Node(_io_service));
+  add_node();
 
   if (size() == 1) return;
 
-  auto& n           = _nodes.back();
+  auto& n           = *_nodes.back();
   auto& random      = Random::instance();
   size_t edge_count = random.generate_int(0, (size() - 1)/2 + 1);
 
   for (size_t i = 0; i < edge_count; ++i) {
-    size_t m_id = random.generate_int(0, size() - 2);
-    auto&  m    = _nodes[m_id];
+    size_t m_i  = random.generate_int(0, size() - 2);
+    auto&  m    = (*this)[m_i];
     assert(m.id() != n.id());
-    n.connect(m.local_endpoint());
-    m.connect(n.local_endpoint());
+    auto n_id = n.id();
+    auto m_id = m.id();
+    on_shard_of(n, [&n, m_id]() { n.connect(m_id); });
+    on_shard_of(m, [&m, n_id]() { m.connect(n_id); });
   }
 
-  vector<Graph> graphs = build_graph().connected_subgraphs();
-
-  for (auto& graph : graphs) {
-    WhenAll when_all(_on_algorithm_completed);
-
-    for (auto& graph_node : graph.nodes) {
-      auto& node = *find(graph_node.id);
-      node.on_fast_mis_ended(when_all.make_continuation());
-    }
-  }
+  // Read after the connects above, which went to the same shards first.
+  async_snapshot([this, &n](const Snapshot& snapshot) {
+      auto graph      = snapshot.build_csr_graph();
+      auto components = graph.components();
+
+      for (size_t c = 0; c < components.count(); ++c) {
+        WhenAll when_all(_on_algorithm_completed);
+
+        for (auto v = components.begin(c); v != components.end(c); ++v) {
+          auto& node = *find(graph.ids[*v]);
+          auto continuation = when_all.make_continuation();
+          on_shard_of(node, [&node, continuation]() {
+              node.on_fast_mis_ended(continuation);
+              });
+        }
+      }
 
-  n.start_fast_mis();
+      on_shard_of(n, [&n]() { n.start_fast_mis(); });
+      });
 }
 
 void Network::shutdown_random_node() {
@@ -203,49 +452,105 @@ void Network::shutdown_random_node() {
 
   auto& random   = Random::instance();
   size_t pick_i  = random.generate_int(0, size() - 1);
-  Node&  pick    = _nodes[pick_i];
+  Node&  pick    = (*this)[pick_i];
 
   log("Removing ", pick.id());
 
-  vector<Graph> graphs = build_graph().connected_subgraphs();
+  if (_recovery == Node::Recovery::repair) {
+    shutdown_and_wait_for_repair(pick);
+    return;
+  }
 
-  WhenAll when_all(_on_algorithm_completed);
+  async_snapshot([this, &pick](const Snapshot& snapshot) {
+      auto graph = snapshot.build_csr_graph();
 
-  for (auto& graph : graphs) {
-    // Subgraphs which are not connected to 'pick' will not
-    // re-elect.
-    if (!graph.nodes.count(pick.id())) continue;
+      WhenAll when_all(_on_algorithm_completed);
 
-    for (auto& graph_node : graph.nodes) {
-      auto& node = *find(graph_node.id);
+      // Subgraphs which are not connected to 'pick' will not re-elect.
+      auto components = graph.components();
+      auto c = components.label[graph.vertex(pick.id())];
 
-      // The picked node will not decide.
-      if (node.id() == pick.id()) continue;
+      for (auto v = components.begin(c); v != components.end(c); ++v) {
+        auto& node = *find(graph.ids[*v]);
 
-      node.on_fast_mis_ended(when_all.make_continuation());
-    }
-  }
+        // The picked node will not decide.
+        if (node.id() == pick.id()) continue;
 
-  pick.shutdown();
+        auto continuation = when_all.make_continuation();
+        on_shard_of(node, [&node, continuation]() {
+            node.on_fast_mis_ended(continuation);
+            });
+      }
+
+      on_shard_of(pick, [&pick]() { pick.shutdown(); });
+      });
 }
 
+// Nodes are destroyed by the calling thread, so with more than one
+// shard this must only be called while the shards are not running.
 void Network::remove_dead_nodes() {
-  _nodes.erase_if([](const Node& n) { return n.is_dead(); });
+  erase_nodes_if([](const Node& n) { return n.is_dead(); });
 }
 
+// Same as remove_dead_nodes, only while the shards are not running.
 void Network::remove_singletons() {
-  _nodes.erase_if([](const Node& n) { return n.size() == 0; });
+  erase_nodes_if([](const Node& n) { return n.size() == 0; });
 }
 
 void Network::set_ping_timeout(boost::posix_time::time_duration d) {
-  for (auto& node : _nodes) {
-    node.set_ping_timeout(d);
+  for (auto& node : *this) {
+    on_shard_of(node, [&node, d]() { node.set_ping_timeout(d); });
+  }
+}
+
+// Which neighbors repair depends on the order in which they notice the
+// loss, a follower may hear of a repairing neighbor's new leadership
+// before it notices anything. So rather than waiting for particular
+// nodes, this polls until every neighbor has noticed and no node is
+// running anymore.
+void Network::shutdown_and_wait_for_repair(Node& pick) {
+  assert(_shards.size() == 1 && "node state is polled from one thread");
+
+  vector<ID> neighbors;
+  pick.each_connection([&](const Connection& c) { neighbors.push_back(c.id()); });
+
+  auto pick_id = pick.id();
+  pick.shutdown();
+
+  auto timer = std::make_shared<asio::deadline_timer>(*_shards[0]);
+  wait_for_repair(pick_id, std::move(neighbors), timer);
+}
+
+void Network::wait_for_repair( ID lost
+                             , vector<ID> neighbors
+                             , std::shared_ptr<asio::deadline_timer> timer) {
+  timer->expires_from_now(posix_time::milliseconds(5));
+  timer->async_wait([this, lost, neighbors, timer](const boost::system::error_code&) {
+      for (auto id : neighbors) {
+        auto node = find(id);
+        if (node && node->is_connected_to(lost)) {
+          return wait_for_repair(lost, neighbors, timer);
+        }
+      }
+
+      if (!every_node_stopped()) {
+        return wait_for_repair(lost, neighbors, timer);
+      }
+
+      if (_on_algorithm_completed) _on_algorithm_completed();
+      });
+}
+
+void Network::set_recovery(Node::Recovery recovery) {
+  _recovery = recovery;
+  for (auto& node : *this) {
+    on_shard_of(node, [&node, recovery]() { node.set_recovery(recovery); });
   }
 }
 
 void Network::set_max_missed_ping_count(unsigned int c) {
-  for (auto& node : _nodes) {
-    node.set_max_missed_ping_count(c);
+  for (auto& node : *this) {
+    on_shard_of(node, [&node, c]() { node.set_max_missed_ping_count(c); });
   }
 }
 
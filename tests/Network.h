@@ -1,22 +1,79 @@
 #ifndef __NETWORK_H__
 #define __NETWORK_H__
 
-#include <boost/ptr_container/ptr_vector.hpp>
+#include <unordered_map>
 #include <boost/asio.hpp>
+#include <boost/iterator/indirect_iterator.hpp>
 #include "Graph.h"
+#include "CsrGraph.h"
+#include "GraphFile.h"
+#include "../IoServicePool.h"
+#include "../MemoryTransport.h"
+#include "../MuxTransport.h"
 #include "../Node.h"
+#include "../Pool.h"
 
 class Network {
-  using Nodes = boost::ptr_vector<Node>;
+  using Nodes = std::vector<Node*>; // From _node_pool
 
 public:
+  using iterator       = boost::indirect_iterator<Nodes::iterator>;
+  using const_iterator = boost::indirect_iterator<Nodes::const_iterator>;
+
   Network(boost::asio::io_service&);
 
+  // Nodes are spread round robin over the shards of the pool. Functions
+  // which start or stop nodes hand the work to each node's own shard and
+  // read node state through async_snapshot, so they may be called from
+  // any shard's handler. Those which add or remove nodes change the node
+  // list itself, only call them while no other shard is running.
+  Network(IoServicePool&);
+
+  // Every node as seen from its own shard, in node order.
+  class Snapshot {
+  public:
+    struct Entry {
+      ID              id;
+      LeaderStatus    status;
+      bool            is_running;
+      bool            every_neighbor_decided;
+      std::vector<ID> neighbors;
+    };
+
+    std::vector<Entry> nodes;
+
+    CsrGraph build_csr_graph() const;
+    // Vertices in node order.
+    Topology topology() const;
+
+    bool is_MIS() const { return build_csr_graph().is_MIS(); }
+    bool every_node_stopped() const;
+    bool every_node_decided() const;
+    bool every_neighbor_decided() const;
+  };
+
+  // Nodes added from now on talk through the hub instead of UDP.
+  void use_memory_hub(MemoryHub& hub) { _hub = &hub; }
+
+  // Nodes added from now on share one UDP socket per shard.
+  void use_udp_mux();
+
   Network(Network&&) = default;
   Network(const Network&) = delete;
   Network& operator=(const Network&) = delete;
 
+  ~Network();
+
   void generate_connected(size_t node_count, float exp_neighbors);
+
+  // Adds a node per vertex and connects them along the edges, while
+  // the shards are not running yet. Statuses are not taken over, the
+  // nodes elect their own.
+  void add_topology(const Topology&);
+
+  // Vertices in node order, with the nodes' current leader statuses.
+  // Same threading rules as counters().
+  Topology topology() const { return snapshot().topology(); }
   void add_nodes(size_t node_count);
   void shutdown();
   bool is_MIS() const;
@@ -25,9 +82,30 @@ public:
   bool every_node_decided() const;
   bool every_neighbor_decided() const;
 
-  Nodes::iterator begin() { return _nodes.begin(); }
-  Nodes::iterator end()   { return _nodes.end(); }
-  Node& operator[](size_t i) { return _nodes[i]; }
+  // Sum over all nodes, call it when no shard is running or
+  // with a single shard.
+  Counters counters() const;
+
+  // Same threading rules as counters().
+  Snapshot snapshot() const;
+
+  // Reads each node on its own shard and hands the result to 'f' on
+  // whichever shard finished last, so it is safe while other shards
+  // run. Anything dispatched to a node before is seen.
+  void async_snapshot(std::function<void(const Snapshot&)> f);
+
+  // Heap memory of the nodes and their connections, transports
+  // excluded. Same threading rules as counters().
+  size_t memory_usage() const;
+
+  iterator begin() { return _nodes.begin(); }
+  iterator end()   { return _nodes.end(); }
+  const_iterator begin() const { return _nodes.begin(); }
+  const_iterator end()   const { return _nodes.end(); }
+  Node& operator[](size_t i) { return *_nodes[i]; }
+
+  // Null if there is no such node.
+  Node* find(ID);
 
   void start_fast_mis(const std::function<void()>&);
   void start_fast_mis();
@@ -38,6 +116,8 @@ public:
   bool empty() const { return _nodes.empty(); }
 
   Graph build_graph() const;
+  // Same threading rules as counters().
+  CsrGraph build_csr_graph() const { return snapshot().build_csr_graph(); }
 
   void add_random_node();
   void shutdown_random_node();
@@ -48,16 +128,43 @@ public:
   void set_ping_timeout(boost::posix_time::time_duration);
   void set_max_missed_ping_count(unsigned int);
 
+  // In repair mode shutdown_random_node only works
+  // on a single shard.
+  void set_recovery(Node::Recovery);
+
 private:
-  void extract_connected(Network&, Nodes::iterator);
-  Nodes::iterator find(ID);
+  void extract_connected(Network&, iterator);
+
+  static Snapshot::Entry read_node(const Node&);
+
+  Node& add_node();
+  template<class Pred> void erase_nodes_if(const Pred&);
+
+  Node* new_node();
+
+  void shutdown_and_wait_for_repair(Node&);
+  void wait_for_repair( ID lost
+                      , std::vector<ID> neighbors
+                      , std::shared_ptr<boost::asio::deadline_timer>);
+
+  // Runs f on the node's shard, right away if that is the calling thread.
+  template<class F> static void on_shard_of(Node& node, F&& f) {
+    node.get_io_service().dispatch(std::forward<F>(f));
+  }
 
 private:
   friend std::ostream& operator<<(std::ostream&, const Network&);
 
-  boost::asio::io_service& _io_service;
-  Nodes                    _nodes;
-  std::function<void()>    _on_algorithm_completed;
+  std::vector<boost::asio::io_service*> _shards;
+  size_t                                _next_shard;
+  IoServicePool*                        _pool;
+  MemoryHub*                            _hub;
+  std::vector<std::unique_ptr<UdpMux>>  _muxes; // One per shard
+  Pool<Node>                            _node_pool;
+  Nodes                                 _nodes;
+  std::unordered_map<ID, Node*>         _index;
+  std::function<void()>                 _on_algorithm_completed;
+  Node::Recovery                        _recovery;
 };
 
 std::ostream& operator<<(std::ostream& os, const Network&);
@@ -0,0 +1,120 @@
+#include <algorithm>
+#include "SequentialMIS.h"
+
+using namespace std;
+using Vertex = AdjacencyArray::Vertex;
+
+//------------------------------------------------------------------------------
+// Stateless, so a vertex's number only depends on the seed and
+// the round, not on the order vertices are visited in.
+static uint64_t mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+//------------------------------------------------------------------------------
+static void make_followers( const AdjacencyArray& g
+                          , Vertex leader
+                          , vector<LeaderStatus>& status) {
+  for (auto u = g.begin(leader); u != g.end(leader); ++u) {
+    if (status[*u] == LeaderStatus::undecided) {
+      status[*u] = LeaderStatus::follower;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+MISResult greedy_mis(const AdjacencyArray& g) {
+  MISResult result{ vector<LeaderStatus>(g.vertex_count()
+                                        , LeaderStatus::undecided)
+                  , 0 };
+  auto& status = result.status;
+
+  for (Vertex v = 0; v < g.vertex_count(); ++v) {
+    if (status[v] != LeaderStatus::undecided) continue;
+    status[v] = LeaderStatus::leader;
+    make_followers(g, v, status);
+  }
+
+  return result;
+}
+
+//------------------------------------------------------------------------------
+MISResult fast_mis(const AdjacencyArray& g, uint64_t seed) {
+  size_t n = g.vertex_count();
+
+  MISResult result{ vector<LeaderStatus>(n, LeaderStatus::undecided), 0 };
+  auto& status = result.status;
+
+  vector<uint64_t> number(n);
+  vector<Vertex>   active(n);
+  vector<Vertex>   leaders;
+
+  for (Vertex v = 0; v < n; ++v) active[v] = v;
+
+  while (!active.empty()) {
+    uint64_t round_seed = mix(seed ^ mix(++result.rounds));
+
+    for (auto v : active) number[v] = mix(round_seed ^ v);
+
+    leaders.clear();
+
+    for (auto v : active) {
+      bool smallest = true;
+
+      for (auto u = g.begin(v); u != g.end(v); ++u) {
+        if (status[*u] != LeaderStatus::undecided) continue;
+        if (number[*u] < number[v] || (number[*u] == number[v] && *u < v)) {
+          smallest = false;
+          break;
+        }
+      }
+
+      if (smallest) leaders.push_back(v);
+    }
+
+    // Only now, so that the election above saw this round's
+    // contenders and nobody else.
+    for (auto v : leaders) status[v] = LeaderStatus::leader;
+    for (auto v : leaders) make_followers(g, v, status);
+
+    active.erase( remove_if( active.begin(), active.end()
+                           , [&](Vertex v) {
+                               return status[v] != LeaderStatus::undecided;
+                             })
+                , active.end());
+  }
+
+  return result;
+}
+
+//------------------------------------------------------------------------------
+bool is_mis(const AdjacencyArray& g, const vector<LeaderStatus>& status) {
+  if (status.size() != g.vertex_count()) return false;
+
+  for (Vertex v = 0; v < g.vertex_count(); ++v) {
+    bool has_leader_neighbor = false;
+
+    for (auto u = g.begin(v); u != g.end(v); ++u) {
+      if (status[*u] == LeaderStatus::leader) {
+        has_leader_neighbor = true;
+        break;
+      }
+    }
+
+    switch (status[v]) {
+      case LeaderStatus::undecided:
+        return false;
+      case LeaderStatus::follower:
+        if (!has_leader_neighbor) return false;
+        break;
+      case LeaderStatus::leader:
+        if (has_leader_neighbor) return false;
+        break;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,27 @@
+#ifndef __SEQUENTIAL_MIS_H__
+#define __SEQUENTIAL_MIS_H__
+
+#include <vector>
+#include "AdjacencyArray.h"
+#include "../LeaderStatus.h"
+
+// Single threaded, in memory reference solvers to check and baseline
+// the distributed runs against.
+
+struct MISResult {
+  std::vector<LeaderStatus> status; // Indexed by vertex
+  size_t                    rounds; // Zero for greedy_mis
+};
+
+// Takes every vertex whose lower numbered neighbors are all followers.
+MISResult greedy_mis(const AdjacencyArray&);
+
+// Simulates the rounds Node goes through: every undecided vertex draws a
+// number, the ones smaller than all their undecided neighbors' become
+// leaders and their neighbors followers. Equal numbers are settled by
+// vertex index, so no round is lost to a tie.
+MISResult fast_mis(const AdjacencyArray&, uint64_t seed);
+
+bool is_mis(const AdjacencyArray&, const std::vector<LeaderStatus>&);
+
+#endif // ifndef __SEQUENTIAL_MIS_H__
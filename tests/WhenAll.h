@@ -1,12 +1,14 @@
 #ifndef __WHEN_ALL_H__
 #define __WHEN_ALL_H__
 
+#include <atomic>
 #include <functional>
+#include <memory>
 
 class WhenAll {
 public:
   template<class Handler> WhenAll(const Handler& handler)
-    : _instance_count(new size_t(0))
+    : _instance_count(new std::atomic<size_t>(0))
     , _handler(handler)
   {}
 
@@ -26,8 +28,9 @@ public:
   }
 
 private:
-  std::shared_ptr<size_t> _instance_count;
-  std::function<void()>   _handler;
+  // Continuations may run on different threads.
+  std::shared_ptr<std::atomic<size_t>> _instance_count;
+  std::function<void()>                _handler;
 };
 
 #endif // ifndef __WHEN_ALL_H__
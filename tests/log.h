@@ -0,0 +1,20 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <iostream>
+
+// Text diagnostics of the tests, the nodes themselves use Trace.h.
+#ifndef NDEBUG
+template<typename... Ts>
+void log(const Ts&... args) {
+  // Not recursive, a single argument call would be ambiguous
+  // with std::log.
+  int expand[] = { 0, ((std::cerr << args), 0)... };
+  (void) expand;
+  std::cerr << std::endl;
+}
+#else
+template<typename... Ts> void log(const Ts&...) {}
+#endif
+
+#endif // ifndef __LOG_H__
@@ -5,11 +5,30 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/asio.hpp>
 #include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
 #include "Random.h"
 #include "Network.h"
 #include "constants.h"
 #include "log.h"
 #include "WhenAll.h"
+#include "TimerWheel.h"
+#include "SequentialMIS.h"
+#include "CsrGraph.h"
+#include "NeighborState.h"
+#include "Philox.h"
+#include "IoServicePool.h"
+#include "Trace.h"
+#include "RingBuffer.h"
+#include "Pool.h"
+#include "Connection.h"
+#include "GraphFile.h"
+#include "Generators.h"
+#include "UdpTransport.h"
 
 namespace asio = boost::asio;
 namespace pstime = boost::posix_time;
@@ -17,6 +36,19 @@ using milliseconds = pstime::milliseconds;
 using namespace std;
 using Error = boost::system::error_code;
 
+// Heap allocations made by this thread, to check the paths that
+// must not allocate.
+static thread_local size_t allocation_count = 0;
+
+void* operator new(size_t size) {
+  ++allocation_count;
+  if (void* p = malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
 //------------------------------------------------------------------------------
 // Test if graph tests are correct.
 BOOST_AUTO_TEST_CASE(graph_tests) {
@@ -185,6 +217,209 @@ BOOST_AUTO_TEST_CASE(graph_tests) {
   }
 }
 
+//------------------------------------------------------------------------------
+// Messages must survive an encode/decode round trip in both wire formats.
+BOOST_AUTO_TEST_CASE(wire_formats) {
+  for (auto format : { WireFormat::text, WireFormat::binary }) {
+    string data;
+    encode_message(format, PingMsg(1, 0), data);
+    BOOST_REQUIRE_EQUAL(is_binary_message(data.data(), data.size())
+                       , format == WireFormat::binary);
+
+    int count = 0;
+    auto fail = [](const Message&) { BOOST_FAIL("wrong message type"); };
+
+    dispatch_datagram(data.data(), data.size()
+        , [&](const PingMsg& m) {
+            BOOST_REQUIRE_EQUAL(m.sequence_number, 1);
+            BOOST_REQUIRE_EQUAL(m.ack_sequence_number, 0);
+            ++count;
+          }
+        , fail, fail, fail, fail, fail, fail);
+
+    // Text carries priorities as floats.
+    uint64_t priority = 0xfedcba9876543210ULL;
+    if (format == WireFormat::text) priority = text_priority(priority);
+
+    data.clear();
+    encode_message(format, NumberMsg(7, 42, priority), data);
+
+    dispatch_datagram(data.data(), data.size()
+        , fail, fail
+        , [&](const NumberMsg& m) {
+            BOOST_REQUIRE_EQUAL(m.sequence_number, 7);
+            BOOST_REQUIRE_EQUAL(m.ack_sequence_number, 42);
+            BOOST_REQUIRE_EQUAL(m.random_number, priority);
+            ++count;
+          }
+        , fail, fail, fail, fail);
+
+    data.clear();
+    encode_message(format, Update2Msg(3, 2, LeaderStatus::follower), data);
+
+    dispatch_datagram(data.data(), data.size()
+        , fail, fail, fail, fail
+        , [&](const Update2Msg& m) {
+            BOOST_REQUIRE_EQUAL(m.sequence_number, 3);
+            BOOST_REQUIRE(m.status == LeaderStatus::follower);
+            ++count;
+          }
+        , fail, fail);
+
+    BOOST_REQUIRE_EQUAL(count, 3);
+
+    // Several messages coalesced into one datagram.
+    data.clear();
+    encode_message(format, StartMsg(4, 3), data);
+    encode_message(format, ResultMsg(5, 3, LeaderStatus::leader), data);
+    encode_message(format, RepairMsg(6, 3), data);
+
+    vector<uint32_t> sequence_numbers;
+    auto record = [&](const Message& m) {
+      sequence_numbers.push_back(m.sequence_number);
+    };
+
+    dispatch_datagram(data.data(), data.size()
+        , fail, record, fail, fail, fail, record, record);
+
+    BOOST_REQUIRE(sequence_numbers == vector<uint32_t>({ 4, 5, 6 }));
+  }
+
+  { // Selective acks only exist in the binary format
+    string data;
+    PingMsg ping(0, 9);
+    ping.ack_bitmap = 0x80000005;
+    encode_message(WireFormat::binary, ping, data);
+
+    auto fail = [](const Message&) { BOOST_FAIL("wrong message type"); };
+
+    dispatch_datagram(data.data(), data.size()
+        , [&](const PingMsg& m) {
+            BOOST_REQUIRE_EQUAL(m.ack_sequence_number, 9);
+            BOOST_REQUIRE_EQUAL(m.ack_bitmap, 0x80000005);
+          }
+        , fail, fail, fail, fail, fail, fail);
+  }
+
+  { // Truncated binary message
+    string data;
+    encode_message(WireFormat::binary, ResultMsg(1, 1, LeaderStatus::leader)
+                  , data);
+    data.resize(data.size() - 1);
+    auto ignore = [](const Message&) {};
+    BOOST_REQUIRE_THROW(dispatch_datagram(data.data(), data.size()
+                                        , ignore, ignore, ignore
+                                        , ignore, ignore, ignore, ignore)
+                       , runtime_error);
+  }
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(timer_wheel) {
+  asio::io_service ios;
+
+  vector<int> fired;
+
+  // Spans the first two levels of the wheel.
+  TimerWheel::Timer t0(ios, [&]() { fired.push_back(0); });
+  TimerWheel::Timer t1(ios, [&]() { fired.push_back(1); });
+  TimerWheel::Timer t2(ios, [&]() { fired.push_back(2); });
+  TimerWheel::Timer t3(ios, [&]() { fired.push_back(3); });
+
+  t2.expires_from_now(milliseconds(150));
+  t0.expires_from_now(milliseconds(5));
+  t3.expires_from_now(milliseconds(200));
+  t1.expires_from_now(milliseconds(70));
+
+  // Re-arming moves the timer, cancelling removes it.
+  t1.expires_from_now(milliseconds(20));
+  t3.cancel();
+
+  BOOST_REQUIRE(t0.is_armed());
+  BOOST_REQUIRE(!t3.is_armed());
+
+  auto start = pstime::microsec_clock::universal_time();
+  ios.run();
+  auto elapsed = pstime::microsec_clock::universal_time() - start;
+
+  BOOST_REQUIRE(fired == vector<int>({ 0, 1, 2 }));
+  BOOST_REQUIRE(elapsed >= milliseconds(140));
+  BOOST_REQUIRE(!t2.is_armed());
+}
+
+//------------------------------------------------------------------------------
+// Timers on the upper levels come down through the cascades and fire in
+// order, also after the wheel fell behind the clock by more than its
+// levels reach, or when they are due further out than that.
+BOOST_AUTO_TEST_CASE(timer_wheel_upper_levels) {
+  asio::io_service ios;
+  auto& wheel = asio::use_service<TimerWheel>(ios);
+
+  vector<int> fired;
+
+  TimerWheel::Timer level0(ios, [&]() { fired.push_back(0); });
+  TimerWheel::Timer level1(ios, [&]() { fired.push_back(1); });
+  TimerWheel::Timer level2(ios, [&]() { fired.push_back(2); });
+  TimerWheel::Timer level3(ios, [&]() { fired.push_back(3); });
+
+  auto settle = [&]() {
+    ios.restart();
+    while (ios.poll()) {}
+  };
+
+  level0.expires_from_now(milliseconds(10));
+  level1.expires_from_now(milliseconds(64 * 63 + 7));
+  level2.expires_from_now(milliseconds(64 * 64 + 100));
+  level3.expires_from_now(milliseconds(64 * 64 * 64 + 1000));
+
+  wheel.skip(milliseconds(100));
+  settle();
+  BOOST_REQUIRE(fired == vector<int>({ 0 }));
+
+  wheel.skip(milliseconds(4000));
+  settle();
+  BOOST_REQUIRE(fired == vector<int>({ 0, 1 }));
+
+  wheel.skip(milliseconds(200));
+  settle();
+  BOOST_REQUIRE(fired == vector<int>({ 0, 1, 2 }));
+  BOOST_REQUIRE(level3.is_armed());
+
+  wheel.skip(milliseconds(64 * 64 * 64));
+  settle();
+  BOOST_REQUIRE(fired == vector<int>({ 0, 1, 2, 3 }));
+  BOOST_REQUIRE_EQUAL(wheel.size(), 0u);
+
+  // The clock runs ahead while a timer is pending, so the next one
+  // is due further from the wheel than the top level reaches.
+  fired.clear();
+  level0.expires_from_now(milliseconds(5));
+  wheel.skip(pstime::hours(5));
+  level1.expires_from_now(pstime::hours(4));
+  BOOST_REQUIRE_EQUAL(wheel.size(), 2u);
+
+  settle();
+  BOOST_REQUIRE(fired == vector<int>({ 0 }));
+  BOOST_REQUIRE(level1.is_armed());
+
+  wheel.skip(pstime::hours(4) + pstime::minutes(1));
+  settle();
+  BOOST_REQUIRE(fired == vector<int>({ 0, 1 }));
+  BOOST_REQUIRE_EQUAL(wheel.size(), 0u);
+
+  // Further out than the top level reaches, on time nonetheless.
+  fired.clear();
+  level3.expires_from_now(pstime::hours(10));
+
+  wheel.skip(pstime::hours(10) - pstime::minutes(1));
+  settle();
+  BOOST_REQUIRE(fired.empty());
+
+  wheel.skip(pstime::minutes(1));
+  settle();
+  BOOST_REQUIRE(fired == vector<int>({ 3 }));
+}
+
 //------------------------------------------------------------------------------
 // This tests whether shutting down one node terminates it, thus no asserts.
 BOOST_AUTO_TEST_CASE(one_node_shutdown) {
@@ -666,4 +901,1561 @@ BOOST_AUTO_TEST_CASE(remove_nodes) {
 }
 
 //------------------------------------------------------------------------------
+// Nodes still speaking the text format must interoperate with binary ones.
+BOOST_AUTO_TEST_CASE(mixed_wire_formats) {
+  for (unsigned int i = 0; i < 10; i++) {
+    Random::instance().initialize_with_random_seed();
+    log("New seed: ", Random::instance().get_seed());
+
+    asio::io_service ios;
+
+    Network network(ios);
+
+    network.generate_connected(5, 2.5);
+
+    bool text = false;
+    for (auto& node : network) {
+      node.set_wire_format(text ? WireFormat::text : WireFormat::binary);
+      text = !text;
+    }
+
+    network.start_fast_mis([&]() {
+        BOOST_REQUIRE(network.every_node_stopped());
+        BOOST_REQUIRE(network.every_node_decided());
+        BOOST_REQUIRE(network.every_neighbor_decided());
+        BOOST_REQUIRE(network.is_MIS());
+        network.shutdown();
+        });
+
+    ios.run();
+  }
+}
+
+//------------------------------------------------------------------------------
+// Nodes spread over several threads must still agree on an MIS.
+BOOST_AUTO_TEST_CASE(sharded_network) {
+  for (unsigned int i = 0; i < 5; i++) {
+    Random::instance().initialize_with_random_seed();
+    log("New seed: ", Random::instance().get_seed());
+
+    IoServicePool pool(4);
+
+    Network network(pool);
+
+    network.generate_connected(100, 4);
+
+    int iterations_left = 3;
+
+    // The handler runs on whichever shard finished last, the
+    // nodes are read on their own.
+    network.start_fast_mis([&]() {
+        network.async_snapshot([&](const Network::Snapshot& snapshot) {
+            BOOST_REQUIRE(snapshot.every_node_stopped());
+            BOOST_REQUIRE(snapshot.every_node_decided());
+            BOOST_REQUIRE(snapshot.every_neighbor_decided());
+            BOOST_REQUIRE(snapshot.is_MIS());
+
+            if (--iterations_left <= 0) {
+              network.shutdown();
+              return;
+            }
+
+            network.start_fast_mis();
+            });
+        });
+
+    pool.run();
+  }
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(in_memory_transport) {
+  for (unsigned int i = 0; i < 3; i++) {
+    Random::instance().initialize_with_random_seed();
+    log("New seed: ", Random::instance().get_seed());
+
+    asio::io_service ios;
+
+    MemoryHub hub;
+    hub.set_loss_probability(0.1);
+    hub.set_duplicate_probability(0.1);
+
+    Network network(ios);
+    network.use_memory_hub(hub);
+
+    network.generate_connected(200, 3);
+
+    // Lost messages wait for the next tick to be resent.
+    network.set_ping_timeout(milliseconds(20));
+
+    int iterations_left = 3;
+
+    network.start_fast_mis([&]() {
+        BOOST_REQUIRE(network.every_node_stopped());
+        BOOST_REQUIRE(network.every_node_decided());
+        BOOST_REQUIRE(network.every_neighbor_decided());
+        BOOST_REQUIRE(network.is_MIS());
+
+        if (--iterations_left <= 0) {
+          network.shutdown();
+          return;
+        }
+
+        network.start_fast_mis();
+        });
+
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(iterations_left, 0);
+    BOOST_REQUIRE(hub.dropped_count() > 0);
+    BOOST_REQUIRE(hub.duplicated_count() > 0);
+  }
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(multiplexed_nodes) {
+  for (unsigned int i = 0; i < 3; i++) {
+    Random::instance().initialize_with_random_seed();
+    log("New seed: ", Random::instance().get_seed());
+
+    IoServicePool pool(2);
+
+    Network network(pool);
+    network.use_udp_mux();
+
+    network.generate_connected(300, 3);
+
+    // One socket per shard.
+    set<Endpoint> endpoints;
+    for (auto& node : network) endpoints.insert(node.local_endpoint());
+    BOOST_REQUIRE_EQUAL(endpoints.size(), pool.size());
+
+    int iterations_left = 3;
+
+    // The handler runs on whichever shard finished last, the
+    // nodes are read on their own.
+    network.start_fast_mis([&]() {
+        network.async_snapshot([&](const Network::Snapshot& snapshot) {
+            BOOST_REQUIRE(snapshot.every_node_stopped());
+            BOOST_REQUIRE(snapshot.every_node_decided());
+            BOOST_REQUIRE(snapshot.every_neighbor_decided());
+            BOOST_REQUIRE(snapshot.is_MIS());
+
+            if (--iterations_left <= 0) {
+              network.shutdown();
+              return;
+            }
+
+            network.start_fast_mis();
+            });
+        });
+
+    pool.run();
+
+    BOOST_REQUIRE_EQUAL(iterations_left, 0);
+  }
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(sequential_mis) {
+  { // Path 0 - 1 - 2 - 3
+    AdjacencyArray g(4, {{0,1}, {2,1}, {2,3}, {3,2}, {1,1}});
+
+    BOOST_REQUIRE_EQUAL(g.edge_count(), 3);
+    BOOST_REQUIRE_EQUAL(g.degree(1), 2);
+
+    auto greedy = greedy_mis(g).status;
+    BOOST_REQUIRE(greedy[0] == LeaderStatus::leader);
+    BOOST_REQUIRE(greedy[1] == LeaderStatus::follower);
+    BOOST_REQUIRE(greedy[2] == LeaderStatus::leader);
+    BOOST_REQUIRE(greedy[3] == LeaderStatus::follower);
+    BOOST_REQUIRE(is_mis(g, greedy));
+
+    greedy[2] = LeaderStatus::follower;
+    BOOST_REQUIRE(!is_mis(g, greedy));
+    greedy[3] = LeaderStatus::leader;
+    BOOST_REQUIRE(is_mis(g, greedy));
+    greedy[1] = LeaderStatus::leader;
+    BOOST_REQUIRE(!is_mis(g, greedy));
+  }
+
+  { // Sparse random graph, big enough to notice anything quadratic
+    size_t n = 1 << 18;
+    auto& random = Random::instance();
+
+    vector<AdjacencyArray::Edge> edges;
+    for (size_t i = 0; i < 2 * n; ++i) {
+      edges.emplace_back( random.generate_int(0, n - 1)
+                        , random.generate_int(0, n - 1));
+    }
+
+    AdjacencyArray g(n, edges);
+
+    BOOST_REQUIRE(is_mis(g, greedy_mis(g).status));
+
+    auto result = fast_mis(g, random.get_seed());
+    BOOST_REQUIRE(is_mis(g, result.status));
+
+    // Expected O(log n) rounds.
+    BOOST_REQUIRE_LE(result.rounds, 4 * 18);
+  }
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(csr_graph) {
+  auto& random = Random::instance();
+
+  // Agrees with Graph on small random graphs.
+  for (unsigned int i = 0; i < 200; ++i) {
+    Graph g;
+    unsigned short n = random.generate_int(0, 12);
+
+    for (unsigned short v = 0; v < n; ++v) {
+      g.nodes.emplace(v, LeaderStatus(random.generate_int(1, 2)));
+    }
+
+    for (unsigned short v = 1; v < n; ++v) {
+      if (random.generate_int(0, 2) == 0) continue;
+      g.connect(v, random.generate_int(0, v - 1));
+    }
+
+    CsrGraph csr(g);
+
+    BOOST_REQUIRE_EQUAL(csr.size(), g.nodes.size());
+    BOOST_REQUIRE_EQUAL(csr.is_MIS(), g.is_MIS());
+
+    auto expected = g.connected_subgraphs();
+    auto actual   = csr.connected_subgraphs();
+
+    BOOST_REQUIRE_EQUAL(actual.size(), expected.size());
+
+    for (const auto& sub : actual) {
+      auto first = find_if( expected.begin(), expected.end()
+                          , [&](const Graph& e) {
+                              return e.nodes.begin()->id == sub.ids[0];
+                            });
+
+      BOOST_REQUIRE(first != expected.end());
+      BOOST_REQUIRE_EQUAL(sub.size(), first->nodes.size());
+      BOOST_REQUIRE_EQUAL(sub.is_MIS(), first->is_MIS());
+    }
+  }
+
+  { // A long path must not recurse.
+    size_t n = 200000;
+
+    vector<ID>             ids;
+    vector<LeaderStatus>   status;
+    vector<CsrGraph::Edge> edges;
+
+    for (size_t v = 0; v < n; ++v) {
+      ids.push_back(Endpoint(asio::ip::address_v4(v + 1), 1));
+      status.push_back(v % 2 ? LeaderStatus::follower : LeaderStatus::leader);
+      if (v) edges.emplace_back(v - 1, v);
+    }
+
+    CsrGraph path(move(ids), move(status), edges);
+
+    BOOST_REQUIRE(path.is_MIS());
+    BOOST_REQUIRE_EQUAL(path.connected_subgraphs().size(), 1);
+    BOOST_REQUIRE_EQUAL(path.vertex(path.ids[1234]), 1234);
+  }
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(parallel_components) {
+  auto& random = Random::instance();
+
+  // Enough vertices for several threads, in many small components.
+  size_t n = 1 << 18;
+
+  vector<AdjacencyArray::Edge> edges;
+  for (size_t i = 0; i < n / 2; ++i) {
+    edges.emplace_back( random.generate_int(0, n - 1)
+                      , random.generate_int(0, n - 1));
+  }
+
+  AdjacencyArray g(n, edges);
+
+  auto expected = connected_components(g, 1);
+
+  for (size_t threads : {2, 4, 7}) {
+    auto actual = connected_components(g, threads);
+    BOOST_REQUIRE(actual.label   == expected.label);
+    BOOST_REQUIRE(actual.offsets == expected.offsets);
+    BOOST_REQUIRE(actual.members == expected.members);
+  }
+
+  // Components are closed under edges and numbered
+  // by their smallest vertex.
+  for (AdjacencyArray::Vertex v = 0; v < n; ++v) {
+    for (auto u = g.begin(v); u != g.end(v); ++u) {
+      BOOST_REQUIRE_EQUAL(expected.label[v], expected.label[*u]);
+    }
+  }
+
+  for (size_t c = 1; c < expected.count(); ++c) {
+    BOOST_REQUIRE_LT(*expected.begin(c-1), *expected.begin(c));
+  }
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(network_index) {
+  asio::io_service ios;
+  MemoryHub hub;
+
+  Network network(ios);
+  network.use_memory_hub(hub);
+  network.add_nodes(10000);
+
+  vector<ID> ids;
+  for (auto& node : network) ids.push_back(node.id());
+
+  for (size_t i = 0; i < ids.size(); i += 3) {
+    network.find(ids[i])->shutdown();
+  }
+
+  network.remove_dead_nodes();
+
+  BOOST_REQUIRE_EQUAL(network.size(), ids.size() - (ids.size() + 2) / 3);
+
+  for (size_t i = 0; i < ids.size(); ++i) {
+    auto node = network.find(ids[i]);
+
+    if (i % 3 == 0) {
+      BOOST_REQUIRE(!node);
+    }
+    else {
+      BOOST_REQUIRE(node);
+      BOOST_REQUIRE(node->id() == ids[i]);
+    }
+  }
+
+  network.remove_singletons();
+  BOOST_REQUIRE(network.empty());
+  BOOST_REQUIRE(!network.find(ids[1]));
+}
+
+//------------------------------------------------------------------------------
+// Connections removed from the middle of the hub's slots are
+// swapped with the last one.
+BOOST_AUTO_TEST_CASE(high_degree_node) {
+  asio::io_service ios;
+  MemoryHub hub;
+
+  unsigned int max_missed_ping_count = 3;
+  milliseconds ping_timeout(20);
+
+  Node center(unique_ptr<Transport>(new MemoryTransport(ios, hub)));
+  center.set_ping_timeout(ping_timeout);
+  center.set_max_missed_ping_count(max_missed_ping_count);
+
+  vector<unique_ptr<Node>> leaves;
+  for (unsigned int i = 0; i < 200; ++i) {
+    leaves.emplace_back(new Node(unique_ptr<Transport>(new MemoryTransport(ios, hub))));
+    center.connect(leaves.back()->id());
+  }
+
+  auto shutdown_all = [&]() {
+    center.shutdown();
+    for (auto& leaf : leaves) leaf->shutdown();
+  };
+
+  asio::deadline_timer timer(ios, ping_timeout*max_missed_ping_count);
+
+  timer.async_wait([&](Error) {
+      for (auto& leaf : leaves) {
+        BOOST_REQUIRE(center.is_connected_to(leaf->id()));
+      }
+
+      for (size_t i = 0; i < leaves.size(); i += 3) leaves[i]->shutdown();
+
+      timer.expires_from_now
+        (ping_timeout * pow(2, max_missed_ping_count+2));
+
+      timer.async_wait([&](Error) {
+          for (size_t i = 0; i < leaves.size(); ++i) {
+            BOOST_REQUIRE_EQUAL(center.is_connected_to(leaves[i]->id()), i % 3 != 0);
+          }
+
+          center.start_fast_mis([&]() {
+              BOOST_REQUIRE(center.leader_status() != LeaderStatus::undecided);
+              BOOST_REQUIRE(center.every_neighbor_decided());
+              shutdown_all();
+              });
+          });
+      });
+
+  ios.run();
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(neighbor_state_counters) {
+  NeighborState ns;
+  for (unsigned short i = 0; i < 4; ++i) ns.push_back(ID(i + 1));
+
+  BOOST_REQUIRE(!ns.every_neighbor_decided());
+
+  ns.restart();
+  ns.clear_numbers();
+
+  BOOST_REQUIRE(!ns.has_number_from_all_contenders());
+  ns.set_number(0, 50);
+  ns.set_number(1, 25);
+  ns.set_number(2, 75);
+  BOOST_REQUIRE(!ns.has_number_from_all_contenders());
+  ns.set_number(3, 50);
+  BOOST_REQUIRE(ns.has_number_from_all_contenders());
+  BOOST_REQUIRE(!ns.is_smallest(25, ID(10)));
+  BOOST_REQUIRE(ns.is_smallest(24, ID(10)));
+
+  // Removing the smallest brings the next one up.
+  ns.swap_remove(1);
+  BOOST_REQUIRE_EQUAL(ns.size(), 3u);
+  BOOST_REQUIRE(!ns.is_smallest(60, ID(10)));
+
+  // Equal numbers are ordered by ID, slots 0 and 1 both have 50.
+  BOOST_REQUIRE(ns.is_smallest(50, ID(0)));
+  BOOST_REQUIRE(!ns.is_smallest(50, ID(10)));
+  ns.clear_numbers();
+
+  ns.set_update1(0, LeaderStatus::leader);
+  ns.set_update1(1, LeaderStatus::undecided);
+  BOOST_REQUIRE(ns.has_leader_neighbor());
+  BOOST_REQUIRE(!ns.has_update1_from_all_contenders());
+  ns.set_update1(2, LeaderStatus::undecided);
+  BOOST_REQUIRE(ns.has_update1_from_all_contenders());
+  ns.clear_update1();
+  BOOST_REQUIRE(!ns.has_leader_neighbor());
+
+  ns.set_update2(0, LeaderStatus::leader);
+  ns.set_update2(1, LeaderStatus::follower);
+  ns.set_update2(2, LeaderStatus::undecided);
+  BOOST_REQUIRE(ns.has_update2_from_all_contenders());
+
+  // Only the undecided neighbor keeps contending.
+  ns.end_round();
+  BOOST_REQUIRE(!ns.has_leader_neighbor());
+  BOOST_REQUIRE(!ns.test(0, NeighborState::contender));
+  BOOST_REQUIRE(ns.test(2, NeighborState::contender));
+  BOOST_REQUIRE(!ns.has_number_from_all_contenders());
+  ns.set_number(2, 12);
+  BOOST_REQUIRE(ns.has_number_from_all_contenders());
+  BOOST_REQUIRE(!ns.is_smallest(50, ID(0)));
+
+  ns.set_result(0, LeaderStatus::leader);
+  ns.set_result(1, LeaderStatus::follower);
+  ns.set_result(2, LeaderStatus::undecided);
+  BOOST_REQUIRE(!ns.every_neighbor_decided());
+  ns.set_result(2, LeaderStatus::follower);
+  BOOST_REQUIRE(ns.every_neighbor_decided());
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(philox) {
+  // Known answers from the Random123 distribution.
+  auto r = Philox::generate({{ 0, 0, 0, 0 }}, {{ 0, 0 }});
+  BOOST_REQUIRE(r == (Philox::Counter{{ 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 }}));
+
+  r = Philox::generate({{ 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff }}
+                      , {{ 0xffffffff, 0xffffffff }});
+  BOOST_REQUIRE(r == (Philox::Counter{{ 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd }}));
+
+  r = Philox::generate({{ 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 }}
+                      , {{ 0xa4093822, 0x299f31d0 }});
+  BOOST_REQUIRE(r == (Philox::Counter{{ 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 }}));
+}
+
+//------------------------------------------------------------------------------
+// The same seed elects the same MIS whatever the thread count
+// and the order in which messages arrive.
+BOOST_AUTO_TEST_CASE(reproducible_runs) {
+  Random::instance().initialize_with_random_seed();
+  auto seed = Random::instance().get_seed();
+  log("New seed: ", seed);
+
+  vector<vector<LeaderStatus>> results;
+
+  for (size_t threads : { 1, 4 }) {
+    Random::instance().initialize_with_seed(seed);
+
+    IoServicePool pool(threads);
+    MemoryHub hub;
+    hub.set_duplicate_probability(0.2);
+
+    Network network(pool);
+    network.use_memory_hub(hub);
+    network.generate_connected(300, 4);
+
+    network.start_fast_mis([&]() {
+        network.async_snapshot([&](const Network::Snapshot& snapshot) {
+            BOOST_REQUIRE(snapshot.is_MIS());
+
+            results.emplace_back();
+            for (auto& e : snapshot.nodes) results.back().push_back(e.status);
+
+            network.shutdown();
+            });
+        });
+
+    pool.run();
+  }
+
+  BOOST_REQUIRE_EQUAL(results.size(), 2u);
+  BOOST_REQUIRE(results[0] == results[1]);
+}
+
+//------------------------------------------------------------------------------
+// Losing a node only re-elects around it, leaders stay leaders.
+BOOST_AUTO_TEST_CASE(repair_nodes) {
+  for (unsigned int i = 0; i < 3; i++) {
+    Random::instance().initialize_with_random_seed();
+    log("New seed: ", Random::instance().get_seed());
+
+    asio::io_service ios;
+    MemoryHub hub;
+
+    Network network(ios);
+    network.use_memory_hub(hub);
+    network.set_recovery(Node::Recovery::repair);
+
+    network.generate_connected(40, 3);
 
+    network.set_ping_timeout(milliseconds(10));
+    network.set_max_missed_ping_count(2);
+
+    set<ID> leaders;
+    bool    new_leader = false;
+
+    network.start_fast_mis([&]() {
+        network.remove_dead_nodes();
+
+        BOOST_REQUIRE(network.every_node_decided());
+        BOOST_REQUIRE(network.is_MIS());
+
+        for (auto& node : network) {
+          bool was_leader = leaders.count(node.id());
+          bool is_leader  = node.leader_status() == LeaderStatus::leader;
+          if (was_leader) BOOST_REQUIRE(is_leader);
+          if (is_leader && !was_leader && !leaders.empty()) new_leader = true;
+        }
+
+        leaders.clear();
+        for (auto& node : network) {
+          if (node.leader_status() == LeaderStatus::leader) leaders.insert(node.id());
+        }
+
+        if (network.empty()) {
+          network.shutdown();
+          return;
+        }
+
+        network.remove_singletons();
+        network.shutdown_random_node();
+        });
+
+    ios.run();
+
+    BOOST_REQUIRE(new_leader);
+  }
+}
+
+//------------------------------------------------------------------------------
+// Counters add up to what went through the hub.
+BOOST_AUTO_TEST_CASE(node_counters) {
+  Random::instance().initialize_with_random_seed();
+  log("New seed: ", Random::instance().get_seed());
+
+  asio::io_service ios;
+
+  MemoryHub hub;
+
+  Network network(ios);
+  network.use_memory_hub(hub);
+  network.generate_connected(50, 3);
+  network.set_ping_timeout(milliseconds(20));
+
+  const string garbage = "garbage";
+  MemoryTransport stranger(ios, hub);
+  stranger.start([](ID, const char*, size_t) {});
+  stranger.send(network[0].id(), garbage.data(), garbage.size());
+
+  // Nothing is sent yet, apart from the garbage.
+  hub.set_loss_probability(0.1);
+  hub.set_duplicate_probability(0.2);
+
+  network.start_fast_mis([&]() {
+      BOOST_REQUIRE(network.is_MIS());
+      network.shutdown();
+      stranger.close();
+      });
+
+  ios.run();
+
+  auto c = network.counters();
+
+  BOOST_REQUIRE_EQUAL(c.datagrams_out, hub.sent_count() - 1);
+  BOOST_REQUIRE_EQUAL(c.bytes_out, hub.sent_bytes() - garbage.size());
+  BOOST_REQUIRE_LE(c.datagrams_in, hub.sent_count() - hub.dropped_count()
+                                 + hub.duplicated_count());
+  BOOST_REQUIRE_EQUAL(c.parse_failures, 1u);
+  BOOST_REQUIRE_EQUAL(c.connection_losses, 0u);
+  BOOST_REQUIRE_GE(c.rounds, network.size());
+  BOOST_REQUIRE(c.retransmits > 0);
+  BOOST_REQUIRE_GT(c.messages_out, c.retransmits);
+  BOOST_REQUIRE(c.duplicates > 0);
+  BOOST_REQUIRE(c.time_in_phase[Counters::numbers].count() > 0);
+}
+
+//------------------------------------------------------------------------------
+// Trace records come back out of the rings and through the file format.
+BOOST_AUTO_TEST_CASE(trace_ring) {
+  using udp = asio::ip::udp;
+  ID node(60001), peer(udp::endpoint(udp::v4(), 60002), 7);
+
+  auto ours = [&](const TraceRecord& r) {
+    return r.node_address == 0x7f000001 && r.node_port == 60001
+        && r.peer_port == 60002;
+  };
+
+  // Wraps around this thread's ring.
+  const size_t count = Trace::RING_SIZE + 10;
+
+  for (size_t i = 0; i < count; ++i) {
+    Trace::write(TraceLevel::error, TraceEvent::receive, node, peer, i, 3);
+  }
+
+  std::thread([&]() {
+      Trace::write(TraceLevel::info, TraceEvent::completed, node, peer, 42, 2);
+      }).join();
+
+  stringstream file;
+  Trace::dump(file);
+  auto records = Trace::read(file);
+
+  vector<TraceRecord> mine;
+  copy_if(records.begin(), records.end(), back_inserter(mine), ours);
+
+  BOOST_REQUIRE_EQUAL(mine.size(), Trace::RING_SIZE + 1);
+
+  // The other thread's ring comes first or last, ours in order.
+  auto other = find_if(mine.begin(), mine.end(), [](const TraceRecord& r) {
+      return r.event == uint8_t(TraceEvent::completed);
+      });
+
+  BOOST_REQUIRE(other != mine.end());
+  BOOST_REQUIRE_EQUAL(other->value, 42u);
+  BOOST_REQUIRE_EQUAL(other->level, uint8_t(TraceLevel::info));
+  mine.erase(other);
+
+  for (size_t i = 0; i < mine.size(); ++i) {
+    const auto& r = mine[i];
+    BOOST_REQUIRE_EQUAL(r.value, count - Trace::RING_SIZE + i);
+    BOOST_REQUIRE_EQUAL(r.event, uint8_t(TraceEvent::receive));
+    BOOST_REQUIRE_EQUAL(r.arg, 3u);
+    BOOST_REQUIRE_EQUAL(r.peer_local, 7u);
+    if (i) BOOST_REQUIRE_LE(mine[i - 1].time_ns, r.time_ns);
+  }
+
+  // Levels above TRACE_LEVEL don't evaluate their arguments.
+  bool evaluated = false;
+  TRACE(debug, TraceEvent::send, node, (evaluated = true, peer));
+  BOOST_REQUIRE_EQUAL(evaluated, Trace::enabled(TraceLevel::debug));
+}
+
+//------------------------------------------------------------------------------
+// Messages are plain values, encoding and decoding them doesn't allocate
+// once the buffers have grown, nor does queueing them.
+BOOST_AUTO_TEST_CASE(allocation_free_messages) {
+  string data;
+  data.reserve(256);
+
+  size_t count = 0;
+
+  for (auto format : { WireFormat::text, WireFormat::binary }) {
+    auto before = allocation_count;
+
+    data.clear();
+    encode_message(format, NumberMsg(7, 42, 12345), data);
+    encode_message(format, Update1Msg(8, 42, LeaderStatus::leader), data);
+    encode_message(format, PingMsg(9, 42), data);
+
+    dispatch_datagram(data.data(), data.size(), [&](const Message& m) {
+        BOOST_REQUIRE_EQUAL(m.sequence_number, 7 + count % 3);
+        ++count;
+        });
+
+    BOOST_REQUIRE_EQUAL(allocation_count, before);
+  }
+
+  BOOST_REQUIRE_EQUAL(count, 6u);
+
+  // The original nodes' messages plus a newline, with the priority
+  // as a float.
+  data.clear();
+  encode_message(WireFormat::text, NumberMsg(7, 42, priority_from_float(0.5f)), data);
+  encode_message(WireFormat::text, PingMsg(1, 0), data);
+  BOOST_REQUIRE_EQUAL(data, "number 7 42 0.5\nping 1 0 \n");
+
+  RingBuffer<Message, 4> queue;
+
+  for (uint32_t i = 0; i < 10; ++i) queue.push_back(PingMsg(i, 0));
+  BOOST_REQUIRE_EQUAL(queue.capacity(), 16u);
+
+  auto before = allocation_count;
+
+  // Wraps around without growing.
+  for (uint32_t i = 10; i < 1000; ++i) {
+    BOOST_REQUIRE_EQUAL(queue.front().sequence_number, i - 10);
+    queue.pop_front();
+    queue.push_back(StartMsg(i, 0));
+  }
+
+  BOOST_REQUIRE_EQUAL(allocation_count, before);
+  BOOST_REQUIRE_EQUAL(queue.size(), 10u);
+  BOOST_REQUIRE(queue.back().type == MessageType::start);
+}
+
+//------------------------------------------------------------------------------
+// Connections come from per node pools that shutdown hands back whole,
+// and the neighbor index keeps finding every slot through removals.
+BOOST_AUTO_TEST_CASE(pooled_memory) {
+  Pool<uint64_t> pool(2, 4);
+  vector<uint64_t*> values;
+
+  for (uint64_t i = 0; i < 10; ++i) values.push_back(pool.create(i));
+  BOOST_REQUIRE_EQUAL(pool.capacity(), 2u + 4 + 4);
+
+  pool.destroy(values[3]);
+  BOOST_REQUIRE(pool.create(42) == values[3]);
+  BOOST_REQUIRE_EQUAL(*values[3], 42u);
+
+  for (auto v : values) pool.destroy(v);
+  pool.release();
+  BOOST_REQUIRE_EQUAL(pool.memory_usage(), 0u);
+
+  NeighborState ns;
+  vector<ID> ids;
+
+  for (unsigned short i = 1; i <= 100; ++i) {
+    ns.push_back(ID(i));
+    ids.push_back(ID(i));
+  }
+
+  for (size_t k = 0; ids.size() > 10; ++k) {
+    NeighborState::Slot s = (k * 37) % ids.size();
+    auto removed = ids[s];
+
+    ns.swap_remove(s);
+    ids[s] = ids.back();
+    ids.pop_back();
+
+    BOOST_REQUIRE_EQUAL(ns.find(removed), NeighborState::no_slot);
+
+    for (NeighborState::Slot t = 0; t < ids.size(); ++t) {
+      BOOST_REQUIRE_EQUAL(ns.find(ids[t]), t);
+    }
+  }
+
+  asio::io_service ios;
+  MemoryHub hub;
+
+  Network network(ios);
+  network.use_memory_hub(hub);
+  network.generate_connected(100, 4);
+
+  // Pools and arrays grow by doubling, so a node uses at most about
+  // twice what its connections need.
+  for (const auto& node : network) {
+    auto bytes = node.memory_usage();
+    BOOST_REQUIRE_GE(bytes, node.size() * sizeof(Connection));
+    BOOST_REQUIRE_LE(bytes, (node.size() + 4) * 2 * (sizeof(Connection) + 128));
+  }
+
+  network.start_fast_mis([&]() {
+      BOOST_REQUIRE(network.is_MIS());
+      network.shutdown();
+      });
+
+  ios.run();
+
+  for (const auto& node : network) {
+    BOOST_REQUIRE_EQUAL(node.memory_usage(), 0u);
+  }
+}
+
+//------------------------------------------------------------------------------
+// Topologies load from edge lists and METIS files, and a network's
+// snapshot comes back from the binary format as it was.
+BOOST_AUTO_TEST_CASE(graph_files) {
+  auto temp = [](const string& name) {
+    return "/tmp/fastmis-" + to_string(getpid()) + "-" + name;
+  };
+
+  auto write = [](const string& path, const string& content) {
+    ofstream(path) << content;
+  };
+
+  // A square with a diagonal, labelled sparsely.
+  auto edge_list = temp("edges.txt");
+  write(edge_list, "# comment\n10 20\n20 30 7\n\n30 40\n40 10\n% more\n10 30\n");
+
+  auto metis = temp("square.graph");
+  write(metis, "% comment\n4 5\n2 3 4\n1 3\n1 2 4\n1 3\n");
+
+  auto weighted = temp("weighted.graph");
+  write(weighted, "4 5 011\n9 2 1 3 1 4 1\n9 1 1 3 1\n9 1 1 2 1 4 1\n9 1 1 3 1\n");
+
+  auto from_edges    = load_topology(edge_list);
+  auto from_metis    = load_topology(metis);
+  auto from_weighted = load_topology(weighted);
+
+  BOOST_REQUIRE_EQUAL(from_edges.adjacency.vertex_count(), 4u);
+  BOOST_REQUIRE_EQUAL(from_edges.adjacency.edge_count(), 5u);
+  BOOST_REQUIRE(from_edges.adjacency.offsets == from_metis.adjacency.offsets);
+  BOOST_REQUIRE(from_edges.adjacency.targets == from_metis.adjacency.targets);
+  BOOST_REQUIRE(from_metis.adjacency.targets == from_weighted.adjacency.targets);
+  BOOST_REQUIRE(from_edges.status.empty());
+
+  write(weighted, "4 6\n2 3 4\n1 3\n1 2 4\n1 3\n");
+  BOOST_REQUIRE_THROW(load_metis(weighted), runtime_error);
+  write(edge_list, "1 2\n3 x\n");
+  BOOST_REQUIRE_THROW(load_edge_list(edge_list), runtime_error);
+
+  Random::instance().initialize_with_random_seed();
+  log("New seed: ", Random::instance().get_seed());
+
+  asio::io_service ios;
+  MemoryHub hub;
+
+  Network network(ios);
+  network.use_memory_hub(hub);
+  network.generate_connected(200, 3);
+
+  // Shutting down drops the connections, so snapshot before.
+  Topology snapshot;
+
+  network.start_fast_mis([&]() {
+      snapshot = network.topology();
+      network.shutdown();
+      });
+
+  ios.run();
+
+  auto binary = temp("snapshot.bin");
+  save_binary_topology(binary, snapshot);
+  auto loaded = load_topology(binary);
+
+  BOOST_REQUIRE(loaded.adjacency.offsets == snapshot.adjacency.offsets);
+  BOOST_REQUIRE(loaded.adjacency.targets == snapshot.adjacency.targets);
+  BOOST_REQUIRE(loaded.status == snapshot.status);
+  BOOST_REQUIRE(is_mis(loaded.adjacency, loaded.status));
+
+  // And it builds a network of the same shape.
+  Network copy(ios);
+  copy.use_memory_hub(hub);
+  copy.add_topology(loaded);
+  BOOST_REQUIRE(copy.topology().adjacency.targets == loaded.adjacency.targets);
+
+  // Damaged files are refused: an edge one way only, and a target count
+  // whose size in bytes wraps around to the right file size.
+  Topology damaged;
+  damaged.adjacency.offsets = { 0, 1, 1 };
+  damaged.adjacency.targets = { 1 };
+  save_binary_topology(binary, damaged);
+  BOOST_REQUIRE_THROW(load_topology(binary), runtime_error);
+
+  save_binary_topology(binary, loaded);
+  {
+    fstream file(binary, std::ios::in | std::ios::out | std::ios::binary);
+    uint64_t target_count = loaded.adjacency.targets.size() + (uint64_t(1) << 62);
+    file.seekp(24); // Past the magic, version, flags and vertex count
+    file.write(reinterpret_cast<const char*>(&target_count), sizeof(target_count));
+  }
+  BOOST_REQUIRE_THROW(load_topology(binary), runtime_error);
+
+  for (auto path : { edge_list, metis, weighted, binary }) unlink(path.c_str());
+}
+
+//------------------------------------------------------------------------------
+// Generators give the same graph for a seed whatever the thread count,
+// the expected sizes, and a single component when asked to.
+BOOST_AUTO_TEST_CASE(topology_generators) {
+  auto same = [](const Topology& a, const Topology& b) {
+    return a.adjacency.offsets == b.adjacency.offsets
+        && a.adjacency.targets == b.adjacency.targets;
+  };
+
+  auto is_connected = [](const Topology& t) {
+    return connected_components(t.adjacency, 1).count() == 1;
+  };
+
+  const size_t n = 20000;
+
+  auto gnp = gnp_graph(n, 4.0 / n, 7, false, 1);
+  BOOST_REQUIRE(same(gnp, gnp_graph(n, 4.0 / n, 7, false, 4)));
+  BOOST_REQUIRE(!same(gnp, gnp_graph(n, 4.0 / n, 8, false, 1)));
+  BOOST_REQUIRE_CLOSE(double(gnp.adjacency.edge_count()), 2.0 * n, 5.0);
+  BOOST_REQUIRE(!is_connected(gnp));
+  BOOST_REQUIRE(is_connected(gnp_graph(n, 4.0 / n, 7, true)));
+
+  auto complete = gnp_graph(50, 1, 7);
+  BOOST_REQUIRE_EQUAL(complete.adjacency.edge_count(), 50u * 49 / 2);
+  BOOST_REQUIRE_EQUAL(gnp_graph(50, 0, 7).adjacency.edge_count(), 0u);
+
+  auto rmat = rmat_graph(n, 8 * n, 7, true, 1);
+  BOOST_REQUIRE(same(rmat, rmat_graph(n, 8 * n, 7, true, 4)));
+  BOOST_REQUIRE(is_connected(rmat));
+
+  size_t max_degree = 0;
+  for (AdjacencyArray::Vertex v = 0; v < n; ++v) {
+    max_degree = max(max_degree, rmat.adjacency.degree(v));
+  }
+  // Hubs, far above the average of 16.
+  BOOST_REQUIRE_GT(max_degree, 200u);
+
+  double radius = sqrt(8 / (M_PI * n));
+  auto geometric = geometric_graph(n, radius, 7, false, 1);
+  BOOST_REQUIRE(same(geometric, geometric_graph(n, radius, 7, false, 4)));
+  // Points near the border have fewer neighbors.
+  BOOST_REQUIRE_CLOSE(double(geometric.adjacency.edge_count()), 4.0 * n, 10.0);
+  BOOST_REQUIRE(is_connected(geometric_graph(n, radius, 7, true)));
+
+  auto torus = grid_graph(30, 20, true);
+  auto grid  = grid_graph(30, 20);
+  BOOST_REQUIRE_EQUAL(torus.adjacency.edge_count(), 2u * 600);
+  BOOST_REQUIRE_EQUAL(grid.adjacency.edge_count(), 29u * 20 + 30 * 19);
+  BOOST_REQUIRE(is_connected(grid));
+
+  auto ba = barabasi_albert_graph(n, 3, 7);
+  BOOST_REQUIRE(same(ba, barabasi_albert_graph(n, 3, 7)));
+  BOOST_REQUIRE(is_connected(ba));
+  BOOST_REQUIRE_GT(ba.adjacency.edge_count(), 2u * n);
+  BOOST_REQUIRE_LE(ba.adjacency.edge_count(), 3u * n);
+
+  // Nodes elect over a generated topology as over any other.
+  asio::io_service ios;
+  MemoryHub hub;
+
+  Network network(ios);
+  network.use_memory_hub(hub);
+  network.add_topology(barabasi_albert_graph(300, 2, 7));
+
+  network.start_fast_mis([&]() {
+      BOOST_REQUIRE(network.is_MIS());
+      network.shutdown();
+      });
+
+  ios.run();
+}
+
+//------------------------------------------------------------------------------
+// Datagrams exactly as the original nodes sent them, float priority
+// included, are understood and don't cost the connection.
+BOOST_AUTO_TEST_CASE(baseline_text_number) {
+  const string old_number = "number 2 0 0.53";
+
+  Message msg;
+  dispatch_datagram(old_number.data(), old_number.size(), [&](const Message& m) {
+      msg = m;
+      });
+
+  BOOST_REQUIRE(msg.type == MessageType::number);
+  BOOST_REQUIRE_EQUAL(msg.random_number, priority_from_float(0.53f));
+  BOOST_REQUIRE_LT(priority_from_float(0.25f), msg.random_number);
+
+  // A priority rounded for the text format reads back unchanged.
+  auto priority = text_priority(0x123456789abcdef0ull);
+  string data;
+  encode_message(WireFormat::text, NumberMsg(1, 0, priority), data);
+  dispatch_datagram(data.data(), data.size(), [&](const Message& m) {
+      BOOST_REQUIRE_EQUAL(m.random_number, priority);
+      });
+
+  asio::io_service ios;
+  MemoryHub hub;
+
+  Node node(unique_ptr<Transport>(new MemoryTransport(ios, hub)));
+  node.set_wire_format(WireFormat::text);
+
+  // Acks whatever it gets, as the original nodes did on their pings.
+  MemoryTransport old_node(ios, hub);
+  string replies;
+  old_node.start([&](ID from, const char* data, size_t size) {
+      replies.append(data, size);
+      dispatch_datagram(data, size, [&](const Message& m) {
+          auto ack = "ping 2 " + to_string(m.sequence_number) + " ";
+          old_node.send(from, ack.data(), ack.size());
+          });
+      });
+
+  for (string datagram : { string("start 1 0 "), old_number }) {
+    old_node.send(node.id(), datagram.data(), datagram.size());
+  }
+
+  asio::deadline_timer timer(ios, milliseconds(PING_TIMEOUT_MS));
+  timer.async_wait([&](Error) {
+      BOOST_REQUIRE(node.is_connected_to(old_node.local_id()));
+      BOOST_REQUIRE_EQUAL(node.counters().parse_failures, 0u);
+      BOOST_REQUIRE(node.is_running_mis());
+      node.shutdown();
+      old_node.close();
+      });
+
+  ios.run();
+
+  // The node's own number went out as a float too.
+  auto i = replies.find("number ");
+  BOOST_REQUIRE(i != string::npos);
+  BOOST_REQUIRE(replies.find("0.", i) < replies.find('\n', i));
+}
+
+//------------------------------------------------------------------------------
+// Stands in for a remote node, speaking the binary format by hand and
+// keeping every datagram it gets.
+struct RawPeer {
+  RawPeer(asio::io_service& ios, MemoryHub& hub) : transport(ios, hub) {
+    transport.start([this](ID, const char* data, size_t size) {
+        datagrams.emplace_back();
+        dispatch_datagram(data, size, [&](const Message& m) {
+            datagrams.back().push_back(m);
+            });
+        });
+  }
+
+  void send(ID to, const Message& msg) {
+    string data;
+    encode_message(WireFormat::binary, msg, data);
+    transport.send(to, data.data(), data.size());
+  }
+
+  MemoryTransport         transport;
+  vector<vector<Message>> datagrams;
+};
+
+// Runs whatever is ready without waiting for anything.
+static void settle(asio::io_service& ios) {
+  ios.restart();
+  while (ios.poll()) {}
+}
+
+// Received messages get a frame of their own once the ack delay passes
+// with no data to ride on, steady traffic needs no pings on top, and an
+// idle link is pinged once per tick.
+BOOST_AUTO_TEST_CASE(ack_and_keepalive_frames) {
+  asio::io_service ios;
+  auto& wheel = asio::use_service<TimerWheel>(ios);
+  MemoryHub hub;
+
+  Node node(unique_ptr<Transport>(new MemoryTransport(ios, hub)));
+  RawPeer peer(ios, hub);
+
+  peer.send(node.id(), PingMsg(1, 0));
+  settle(ios);
+  wheel.skip(milliseconds(COALESCE_DELAY_MS));
+  settle(ios);
+
+  // The node's first message carries the ack.
+  BOOST_REQUIRE_EQUAL(peer.datagrams.size(), 1u);
+  BOOST_REQUIRE_EQUAL(peer.datagrams[0][0].sequence_number, 1u);
+  BOOST_REQUIRE_EQUAL(peer.datagrams[0][0].ack_sequence_number, 1u);
+  peer.datagrams.clear();
+
+  peer.send(node.id(), PingMsg(2, 1));
+  settle(ios);
+
+  wheel.skip(milliseconds(ACK_DELAY_MS / 2));
+  settle(ios);
+  BOOST_REQUIRE(peer.datagrams.empty());
+
+  wheel.skip(milliseconds(ACK_DELAY_MS));
+  settle(ios);
+  BOOST_REQUIRE_EQUAL(peer.datagrams.size(), 1u);
+  BOOST_REQUIRE_EQUAL(peer.datagrams[0].size(), 1u);
+  BOOST_REQUIRE(peer.datagrams[0][0].type == MessageType::ping);
+  BOOST_REQUIRE_EQUAL(peer.datagrams[0][0].sequence_number, 1u);
+  BOOST_REQUIRE_EQUAL(peer.datagrams[0][0].ack_sequence_number, 2u);
+
+  // A message every 20 ms, each acked once and nothing else.
+  peer.datagrams.clear();
+  uint32_t sequence_number = 2;
+
+  for (int i = 0; i < 50; ++i) {
+    peer.send(node.id(), PingMsg(++sequence_number, 1));
+    settle(ios);
+    wheel.skip(milliseconds(20));
+    settle(ios);
+  }
+
+  BOOST_REQUIRE_EQUAL(peer.datagrams.size(), 50u);
+
+  for (size_t i = 0; i < peer.datagrams.size(); ++i) {
+    BOOST_REQUIRE_EQUAL(peer.datagrams[i][0].sequence_number, 1u);
+    BOOST_REQUIRE_EQUAL(peer.datagrams[i][0].ack_sequence_number, 3 + i);
+  }
+
+  // A second of silence, the peer answering every ping.
+  peer.datagrams.clear();
+  size_t answered = 0;
+
+  for (int i = 0; i < 100; ++i) {
+    wheel.skip(milliseconds(PING_TIMEOUT_MS / 10));
+    settle(ios);
+
+    for (; answered < peer.datagrams.size(); ++answered) {
+      peer.send(node.id(), PingMsg(0, 1));
+    }
+
+    settle(ios);
+  }
+
+  BOOST_REQUIRE_GE(peer.datagrams.size(), 9u);
+  BOOST_REQUIRE_LE(peer.datagrams.size(), 11u);
+  BOOST_REQUIRE(node.is_connected_to(peer.transport.local_id()));
+
+  node.shutdown();
+  peer.transport.close();
+  settle(ios);
+}
+
+//------------------------------------------------------------------------------
+// Messages arriving out of order wait for the missing ones and are
+// reported in the ack bitmap, anything past the window is dropped.
+BOOST_AUTO_TEST_CASE(reordered_messages) {
+  asio::io_service ios;
+  auto& wheel = asio::use_service<TimerWheel>(ios);
+  MemoryHub hub;
+
+  Node node(unique_ptr<Transport>(new MemoryTransport(ios, hub)));
+  RawPeer peer(ios, hub);
+
+  peer.send(node.id(), PingMsg(1, 0));
+  settle(ios);
+  wheel.skip(milliseconds(COALESCE_DELAY_MS));
+  settle(ios);
+  BOOST_REQUIRE_EQUAL(peer.datagrams.size(), 1u);
+
+  auto acks_after = [&](initializer_list<Message> messages) {
+    peer.datagrams.clear();
+    for (const auto& m : messages) peer.send(node.id(), m);
+    settle(ios);
+    wheel.skip(milliseconds(ACK_DELAY_MS + 1));
+    settle(ios);
+    BOOST_REQUIRE_EQUAL(peer.datagrams.size(), 1u);
+    return peer.datagrams[0].back();
+  };
+
+  // 2 and 5 are missing, bit i stands for 1 + 2 + i.
+  auto ack = acks_after({ PingMsg(3, 1), StartMsg(4, 1), PingMsg(6, 1) });
+  BOOST_REQUIRE_EQUAL(ack.ack_sequence_number, 1u);
+  BOOST_REQUIRE_EQUAL(ack.ack_bitmap, 0xbu);
+  BOOST_REQUIRE(!node.is_running_mis());
+
+  ack = acks_after({ PingMsg(2, 1) });
+  BOOST_REQUIRE_EQUAL(ack.ack_sequence_number, 4u);
+  BOOST_REQUIRE_EQUAL(ack.ack_bitmap, 0x1u);
+  BOOST_REQUIRE(node.is_running_mis());
+
+  // Starting sent the node's own messages, which carry the acks now.
+  BOOST_REQUIRE(ack.type != MessageType::ping);
+
+  ack = acks_after({ PingMsg(5, 1) });
+  BOOST_REQUIRE_EQUAL(ack.ack_sequence_number, 6u);
+  BOOST_REQUIRE_EQUAL(ack.ack_bitmap, 0u);
+
+  // The last of the window is held, one further isn't.
+  ack = acks_after({ PingMsg(6 + WINDOW_SIZE, 1), PingMsg(7 + WINDOW_SIZE, 1) });
+  BOOST_REQUIRE_EQUAL(ack.ack_sequence_number, 6u);
+  BOOST_REQUIRE_EQUAL(ack.ack_bitmap, uint32_t(1) << (WINDOW_SIZE - 2));
+
+  node.shutdown();
+  peer.transport.close();
+  settle(ios);
+}
+
+//------------------------------------------------------------------------------
+// Of the messages in flight only those the ack bitmap doesn't cover
+// go out again, and ack frames repeat the last message the peer has
+// so that the original nodes take them for keep-alives.
+BOOST_AUTO_TEST_CASE(selective_retransmission) {
+  asio::io_service ios;
+  auto& wheel = asio::use_service<TimerWheel>(ios);
+  MemoryHub hub;
+
+  Node node(unique_ptr<Transport>(new MemoryTransport(ios, hub)));
+  RawPeer peer(ios, hub);
+
+  peer.send(node.id(), PingMsg(1, 0));
+  settle(ios);
+
+  peer.datagrams.clear();
+  node.each_connection([](Connection& c) {
+      for (int i = 0; i < 5; ++i) c.schedule_send<StartMsg>();
+      });
+  wheel.skip(milliseconds(COALESCE_DELAY_MS));
+  settle(ios);
+
+  auto sent = [&]() {
+    vector<uint32_t> result;
+    for (const auto& d : peer.datagrams) {
+      for (const auto& m : d) {
+        if (m.type == MessageType::start) result.push_back(m.sequence_number);
+      }
+    }
+    peer.datagrams.clear();
+    return result;
+  };
+
+  BOOST_REQUIRE(sent() == vector<uint32_t>({ 2, 3, 4, 5, 6 }));
+
+  // 2 arrived, then 4 and 6.
+  PingMsg ack(0, 2);
+  ack.ack_bitmap = 0x5;
+  peer.send(node.id(), ack);
+  settle(ios);
+
+  wheel.skip(milliseconds(PING_TIMEOUT_MS));
+  settle(ios);
+  BOOST_REQUIRE(sent() == vector<uint32_t>({ 3, 5 }));
+
+  peer.send(node.id(), PingMsg(1, 6));
+  settle(ios);
+
+  wheel.skip(milliseconds(PING_TIMEOUT_MS));
+  settle(ios);
+  BOOST_REQUIRE(sent().empty());
+
+  // Idle now, the keep-alive is an ack frame naming the node's last
+  // message, which the peer doesn't acknowledge in turn.
+  wheel.skip(milliseconds(PING_TIMEOUT_MS));
+  settle(ios);
+  BOOST_REQUIRE(!peer.datagrams.empty());
+
+  auto keepalive = peer.datagrams.back().back();
+  BOOST_REQUIRE(keepalive.type == MessageType::ping);
+  BOOST_REQUIRE_EQUAL(keepalive.sequence_number, 6u);
+  BOOST_REQUIRE_EQUAL(keepalive.ack_sequence_number, 1u);
+
+  // Nor does the node acknowledge the peer's, it has nothing new.
+  peer.datagrams.clear();
+  peer.send(node.id(), PingMsg(1, 6));
+  settle(ios);
+  wheel.skip(milliseconds(ACK_DELAY_MS + 1));
+  settle(ios);
+  BOOST_REQUIRE(peer.datagrams.empty());
+  BOOST_REQUIRE_EQUAL(node.counters().duplicates, 0u);
+
+  node.shutdown();
+  peer.transport.close();
+  settle(ios);
+}
+
+//------------------------------------------------------------------------------
+// A message to an idle link leaves at once. Those scheduled while it is
+// in flight wait for the coalescing delay and leave together, in a
+// single datagram when they fit.
+BOOST_AUTO_TEST_CASE(coalesced_datagrams) {
+  asio::io_service ios;
+  auto& wheel = asio::use_service<TimerWheel>(ios);
+  MemoryHub hub;
+
+  Node node(unique_ptr<Transport>(new MemoryTransport(ios, hub)));
+  RawPeer peer(ios, hub);
+
+  peer.send(node.id(), PingMsg(1, 0));
+  settle(ios);
+
+  // The window is all for what follows.
+  peer.send(node.id(), PingMsg(1, 1));
+  settle(ios);
+
+  peer.datagrams.clear();
+  auto sent_before = hub.sent_count();
+
+  auto schedule = [&]() {
+    node.each_connection([](Connection& c) { c.schedule_send<StartMsg>(); });
+  };
+
+  schedule();
+  settle(ios);
+  BOOST_REQUIRE_EQUAL(peer.datagrams.size(), 1u);
+  BOOST_REQUIRE_EQUAL(peer.datagrams[0].size(), 1u);
+  peer.datagrams.clear();
+
+  // Scheduled from separate handlers, as replies to separate
+  // datagrams would be.
+  for (size_t i = 1; i < WINDOW_SIZE; ++i) {
+    ios.post(schedule);
+    settle(ios);
+  }
+
+  BOOST_REQUIRE(peer.datagrams.empty());
+
+  wheel.skip(milliseconds(COALESCE_DELAY_MS));
+  settle(ios);
+
+  BOOST_REQUIRE_EQUAL(hub.sent_count() - sent_before, 2u);
+  BOOST_REQUIRE_EQUAL(peer.datagrams.size(), 1u);
+  BOOST_REQUIRE_EQUAL(peer.datagrams[0].size(), WINDOW_SIZE - 1);
+
+  for (size_t i = 0; i + 1 < WINDOW_SIZE; ++i) {
+    BOOST_REQUIRE_EQUAL(peer.datagrams[0][i].sequence_number, 3 + i);
+  }
+
+  node.shutdown();
+  peer.transport.close();
+  settle(ios);
+}
+
+//------------------------------------------------------------------------------
+// The hub hands datagrams over in batches and reuses their buffers,
+// once they have grown passing datagrams around doesn't allocate.
+BOOST_AUTO_TEST_CASE(memory_hub_buffers) {
+  asio::io_service ios;
+  MemoryHub hub;
+
+  MemoryTransport a(ios, hub), b(ios, hub);
+
+  size_t received = 0, bytes = 0;
+  a.start([](ID, const char*, size_t) {});
+  b.start([&](ID source, const char*, size_t size) {
+      BOOST_REQUIRE_EQUAL(source, a.local_id());
+      ++received;
+      bytes += size;
+      });
+
+  const string datagram(MAX_COALESCED_DATAGRAM_SIZE, 'x');
+
+  // Returns the allocations made while sending and delivering, which
+  // happen from handlers as they would for nodes.
+  auto burst = [&]() {
+    ios.post([&]() {
+        for (int i = 0; i < 100; ++i) a.send(b.local_id(), datagram.data(), datagram.size());
+        });
+
+    auto before = allocation_count;
+    settle(ios);
+    return allocation_count - before;
+  };
+
+  burst();
+  burst();
+  BOOST_REQUIRE_EQUAL(burst(), 0u);
+
+  BOOST_REQUIRE_EQUAL(received, 300u);
+  BOOST_REQUIRE_EQUAL(bytes, 300 * datagram.size());
+
+  // Nothing reaches a closed transport, nor one that's gone.
+  b.close();
+  a.send(b.local_id(), datagram.data(), datagram.size());
+  a.send(ID(), datagram.data(), datagram.size());
+  settle(ios);
+  BOOST_REQUIRE_EQUAL(received, 300u);
+}
+
+//------------------------------------------------------------------------------
+// A burst of several batches queued on one socket comes out whole and in
+// order, a batch at a time with other handlers running in between.
+BOOST_AUTO_TEST_CASE(udp_receive_burst) {
+  asio::io_service ios;
+
+  UdpTransport receiver(ios), sender(ios);
+
+  const size_t count = 2 * MAX_DATAGRAMS_PER_RECEIVE + 5;
+
+  // Sizes vary so that a datagram shorter than the one before
+  // would show leftovers of it in the shared buffer.
+  auto datagram = [](size_t i) {
+    return to_string(i) + string(i * 37 % 1000, char('a' + i % 26));
+  };
+
+  size_t received = 0, batches = 0, batch = 0, largest_batch = 0;
+  bool   in_batch = false;
+
+  asio::deadline_timer timeout(ios, pstime::seconds(5));
+
+  receiver.start([&](ID source, const char* data, size_t size) {
+      BOOST_REQUIRE_EQUAL(source.endpoint().port(), sender.local_id().endpoint().port());
+      BOOST_REQUIRE_EQUAL(string(data, size), datagram(received));
+
+      if (!in_batch) {
+        // Runs once the rest of this batch is done.
+        in_batch = true;
+        ++batches;
+        batch = 0;
+        ios.post([&]() { in_batch = false; });
+      }
+
+      largest_batch = max(largest_batch, ++batch);
+
+      if (++received == count) timeout.cancel();
+      });
+
+  for (size_t i = 0; i < count; ++i) {
+    auto data = datagram(i);
+    sender.send(receiver.local_id(), data.data(), data.size());
+  }
+
+  timeout.async_wait([&](Error) {
+      receiver.close();
+      sender.close();
+      });
+
+  ios.run();
+
+  BOOST_REQUIRE_EQUAL(received, count);
+  BOOST_REQUIRE_EQUAL(largest_batch, MAX_DATAGRAMS_PER_RECEIVE);
+  BOOST_REQUIRE_EQUAL(batches, (count + MAX_DATAGRAMS_PER_RECEIVE - 1)
+                              / MAX_DATAGRAMS_PER_RECEIVE);
+}
+
+//------------------------------------------------------------------------------
+// Snapshots read each node on its own shard, after whatever was
+// dispatched to it before.
+BOOST_AUTO_TEST_CASE(sharded_snapshot) {
+  IoServicePool pool(3);
+  MemoryHub hub;
+
+  Network network(pool);
+  network.use_memory_hub(hub);
+  network.add_nodes(6);
+
+  // A path, wired by the shards once they run.
+  for (size_t i = 1; i < network.size(); ++i) {
+    auto& a = network[i - 1];
+    auto& b = network[i];
+    auto a_id = a.id(), b_id = b.id();
+    a.get_io_service().post([&a, b_id]() { a.connect(b_id); });
+    b.get_io_service().post([&b, a_id]() { b.connect(a_id); });
+  }
+
+  size_t edges = 0, components = 0;
+
+  network.async_snapshot([&](const Network::Snapshot& snapshot) {
+      BOOST_REQUIRE_EQUAL(snapshot.nodes.size(), network.size());
+      auto graph = snapshot.build_csr_graph();
+      edges      = graph.adjacency.edge_count();
+      components = graph.components().count();
+      network.shutdown();
+      });
+
+  pool.run();
+
+  BOOST_REQUIRE_EQUAL(edges, network.size() - 1);
+  BOOST_REQUIRE_EQUAL(components, 1u);
+}
+
+//------------------------------------------------------------------------------
+// A message goes again only once the retransmission timeout, measured
+// from the acks of the other side, has passed since it was last sent,
+// and each further timeout in a row doubles it.
+BOOST_AUTO_TEST_CASE(retransmission_timeout) {
+  asio::io_service ios;
+  auto& wheel = asio::use_service<TimerWheel>(ios);
+  MemoryHub hub;
+
+  Node node(unique_ptr<Transport>(new MemoryTransport(ios, hub)));
+  RawPeer peer(ios, hub);
+
+  peer.send(node.id(), PingMsg(1, 0));
+  settle(ios);
+
+  // The node's ping comes back acked 4ms later, so the timeout is the
+  // minimum: srtt + 4 * rttvar is 12ms.
+  wheel.skip(milliseconds(4));
+  peer.send(node.id(), PingMsg(1, 1));
+  settle(ios);
+
+  // The link is idle, this leaves at once.
+  peer.datagrams.clear();
+  node.each_connection([](Connection& c) { c.schedule_send<StartMsg>(); });
+  settle(ios);
+
+  auto starts = [&]() {
+    size_t result = 0;
+    for (const auto& d : peer.datagrams) {
+      for (const auto& m : d) result += m.type == MessageType::start;
+    }
+    peer.datagrams.clear();
+    return result;
+  };
+
+  BOOST_REQUIRE_EQUAL(starts(), 1u);
+
+  wheel.skip(milliseconds(11));
+  settle(ios);
+  BOOST_REQUIRE_EQUAL(starts(), 0u);
+
+  wheel.skip(milliseconds(1));
+  settle(ios);
+  BOOST_REQUIRE_EQUAL(starts(), 1u);
+
+  // Backed off.
+  wheel.skip(milliseconds(23));
+  settle(ios);
+  BOOST_REQUIRE_EQUAL(starts(), 0u);
+
+  wheel.skip(milliseconds(1));
+  settle(ios);
+  BOOST_REQUIRE_EQUAL(starts(), 1u);
+  BOOST_REQUIRE_EQUAL(node.counters().retransmits, 2u);
+  BOOST_REQUIRE_EQUAL(node.counters().messages_out, 4u); // The ping too
+
+  // Once acked nothing goes again, ticks included.
+  peer.send(node.id(), PingMsg(1, 2));
+  settle(ios);
+  wheel.skip(milliseconds(PING_TIMEOUT_MS));
+  settle(ios);
+  BOOST_REQUIRE_EQUAL(starts(), 0u);
+
+  node.shutdown();
+  peer.transport.close();
+  settle(ios);
+}
+
+//------------------------------------------------------------------------------
+// In the text format a node has one message in flight at a time, the
+// original nodes take one ahead of the next in order for an error.
+BOOST_AUTO_TEST_CASE(text_stop_and_wait) {
+  asio::io_service ios;
+  auto& wheel = asio::use_service<TimerWheel>(ios);
+  MemoryHub hub;
+
+  Node node(unique_ptr<Transport>(new MemoryTransport(ios, hub)));
+  node.set_wire_format(WireFormat::text);
+  RawPeer peer(ios, hub);
+
+  peer.send(node.id(), PingMsg(1, 0));
+  settle(ios);
+  node.each_connection([](Connection& c) {
+      for (int i = 0; i < 3; ++i) c.schedule_send<StartMsg>();
+      });
+  wheel.skip(milliseconds(COALESCE_DELAY_MS));
+  settle(ios);
+
+  auto sent = [&]() {
+    vector<uint32_t> result;
+    for (const auto& d : peer.datagrams) {
+      for (const auto& m : d) result.push_back(m.sequence_number);
+    }
+    peer.datagrams.clear();
+    return result;
+  };
+
+  // Only the ping until it's acked, then each start in turn.
+  BOOST_REQUIRE(sent() == vector<uint32_t>({ 1 }));
+
+  for (uint32_t i = 1; i <= 3; ++i) {
+    peer.send(node.id(), PingMsg(1, i));
+    settle(ios);
+    wheel.skip(milliseconds(COALESCE_DELAY_MS));
+    settle(ios);
+    BOOST_REQUIRE(sent() == vector<uint32_t>({ i + 1 }));
+  }
+
+  node.shutdown();
+  peer.transport.close();
+  settle(ios);
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,106 @@
+// Turns trace files written by Trace::dump into text, one record per line
+// and all threads merged in time order:
+//
+//   fastmis-trace trace.bin [more.bin...]
+//
+// Reads the standard input when no file is given.
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include "Trace.h"
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+static string format_id(uint32_t address, uint16_t port, uint32_t local) {
+  stringstream ss;
+  ss << (address >> 24) << '.' << ((address >> 16) & 0xff) << '.'
+     << ((address >> 8) & 0xff) << '.' << (address & 0xff) << ':' << port;
+  if (local) ss << '.' << local;
+  return ss.str();
+}
+
+//------------------------------------------------------------------------------
+static string format_arg(const TraceRecord& r) {
+  static const char* message_types[] = { "ping", "start", "number", "update1"
+                                       , "update2", "result", "repair" };
+  static const char* statuses[] = { "undecided", "follower", "leader" };
+
+  switch (TraceEvent(r.event)) {
+    case TraceEvent::send:
+    case TraceEvent::receive:
+      if (r.arg < sizeof(message_types) / sizeof(*message_types)) {
+        return string(message_types[r.arg]) + " #" + to_string(r.value);
+      }
+      break;
+    case TraceEvent::elected_leader:
+      return "priority " + to_string(r.value);
+    case TraceEvent::completed:
+      if (r.arg < sizeof(statuses) / sizeof(*statuses)) return statuses[r.arg];
+      break;
+    default:
+      return "";
+  }
+
+  return "arg " + to_string(r.arg) + " value " + to_string(r.value);
+}
+
+//------------------------------------------------------------------------------
+static void print(ostream& os, const vector<TraceRecord>& records) {
+  if (records.empty()) return;
+
+  auto start = records.front().time_ns;
+
+  for (const auto& r : records) {
+    auto node = format_id(r.node_address, r.node_port, r.node_local);
+    auto peer = format_id(r.peer_address, r.peer_port, r.peer_local);
+
+    os << fixed << setprecision(6) << setw(12) << (r.time_ns - start) / 1e9
+       << ' ' << setw(5) << Trace::level_name(r.level)
+       << ' ' << node;
+
+    if (peer != node) os << " -> " << peer;
+
+    os << ' ' << Trace::event_name(r.event);
+
+    auto arg = format_arg(r);
+    if (!arg.empty()) os << ' ' << arg;
+
+    os << '\n';
+  }
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+  try {
+    vector<TraceRecord> records;
+
+    auto append = [&](istream& is) {
+      auto rs = Trace::read(is);
+      records.insert(records.end(), rs.begin(), rs.end());
+    };
+
+    if (argc < 2) {
+      append(cin);
+    }
+
+    for (int i = 1; i < argc; ++i) {
+      ifstream file(argv[i], ios::binary);
+      if (!file) throw runtime_error(string("Can't open ") + argv[i]);
+      append(file);
+    }
+
+    stable_sort(records.begin(), records.end(),
+        [](const TraceRecord& a, const TraceRecord& b) {
+          return a.time_ns < b.time_ns;
+        });
+
+    print(cout, records);
+  }
+  catch (const exception& e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+}